@@ -30,6 +30,7 @@
 ////////////////////////////////////////////////////////////////////////
 
 #include <mcontainer.h>
+#include "trace.h"
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -53,6 +54,8 @@ int main(int argc, char *argv[])
     unsigned long long msec_time;
     FILE *fp;
     struct timeval current_time;
+    struct trace_header header = { TRACE_MAGIC, TRACE_VERSION };
+    struct trace_record record;
     pid_t *pid; 
 
     // takes arguments from command line interface.
@@ -94,14 +97,22 @@ int main(int argc, char *argv[])
 
     data = (char *) malloc(max_size_of_objects_with_buffer * sizeof(char));
 
-    // create the log file
+    // create the trace file
     srand((int)time(NULL) + (int)getpid());
-    sprintf(filename, "mcontainer.%d.log", (int)getpid());
+    sprintf(filename, "mcontainer.%d.trace", (int)getpid());
     fp = fopen(filename, "w");
+    if (!fp || fwrite(&header, sizeof(header), 1, fp) != 1)
+    {
+        fprintf(stderr, "Failed to create %s\n", filename);
+        exit(1);
+    }
+    record.pid = getpid();
 
     // create/link this process to a container.
     cid = getpid() % number_of_containers;
     mcontainer_create(devfd, cid);
+    record.cid = cid;
+    record.size = max_size_of_objects;
 
     // Writing to objects
     for (i = 0; i < number_of_objects; i++)
@@ -128,8 +139,12 @@ int main(int argc, char *argv[])
         strncpy(mapped_data, data, max_size_of_objects-1);
         mapped_data[max_size_of_objects-1] = '\0';
         
-        // prints out the result into the log
-        fprintf(fp, "S\t%d\t%d\t%ld\t%d\t%d\t%s\n", getpid(), cid, current_time.tv_sec * 1000000 + current_time.tv_usec, i, max_size_of_objects, mapped_data);
+        // records the result into the trace
+        record.time = current_time.tv_sec * 1000000ULL + current_time.tv_usec;
+        record.oid = i;
+        record.op = TRACE_OP_SET;
+        record.hash = trace_hash(mapped_data, max_size_of_objects);
+        fwrite(&record, sizeof(record), 1, fp);
         mcontainer_unlock(devfd, i);
         memset(data, 0, max_size_of_objects_with_buffer);
     }
@@ -138,8 +153,14 @@ int main(int argc, char *argv[])
     i = rand() % number_of_objects;
     mcontainer_lock(devfd, i);
     mcontainer_free(devfd, i);
-    fprintf(fp, "D\t%d\t%d\t%ld\t%d\t%d\t%s\n", getpid(), cid, current_time.tv_sec * 1000000 + current_time.tv_usec, i, max_size_of_objects, mapped_data);
+    gettimeofday(&current_time, NULL);
+    record.time = current_time.tv_sec * 1000000ULL + current_time.tv_usec;
+    record.oid = i;
+    record.op = TRACE_OP_DELETE;
+    record.hash = trace_hash("", 0);
+    fwrite(&record, sizeof(record), 1, fp);
     mcontainer_unlock(devfd, i);
+    fclose(fp);
     
     
     // done with works, cleanup and wait for other processes.
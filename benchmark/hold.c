@@ -0,0 +1,130 @@
+//////////////////////////////////////////////////////////////////////
+//                      North Carolina State University
+//
+//
+//
+//                             Copyright 2016
+//
+////////////////////////////////////////////////////////////////////////
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms and conditions of the GNU General Public License,
+// version 2, as published by the Free Software Foundation.
+//
+// This program is distributed in the hope it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin St - Fifth Floor, Boston, MA 02110-1301 USA.
+//
+////////////////////////////////////////////////////////////////////////
+//
+//   Description:
+//     Keep Containers Alive Between Benchmark and Validate
+//
+////////////////////////////////////////////////////////////////////////
+
+#include <mcontainer.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+
+// A container and its objects go away when its last task leaves, and every
+// benchmark process leaves its container before it exits. This joins
+// containers 0 .. number_of_containers - 1 with one thread each (tasks are
+// told apart by thread id) and stays in them until it is sent SIGTERM, so
+// validate still finds the objects the benchmark wrote.
+static int devfd, joined;
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
+
+static void *member_main(void *arg)
+{
+    mcontainer_create(devfd, (int)(long)arg);
+    pthread_mutex_lock(&mutex);
+    joined++;
+    pthread_cond_signal(&cond);
+    pthread_mutex_unlock(&mutex);
+    // membership lasts until the process exits and closes devfd
+    for (;;)
+    {
+        pause();
+    }
+    return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+    int number_of_containers, i, ready[2];
+    pthread_t thread;
+    pid_t pid;
+    char c;
+
+    if (argc < 2 || (number_of_containers = atoi(argv[1])) <= 0)
+    {
+        fprintf(stderr, "Usage: %s number_of_containers\n", argv[0]);
+        exit(1);
+    }
+    if (pipe(ready) != 0)
+    {
+        exit(1);
+    }
+
+    // the parent prints the holder's pid once it is in every container,
+    // so a script can run it as hold_pid=$(hold n) and kill it later
+    if ((pid = fork()) != 0)
+    {
+        close(ready[1]);
+        if (pid < 0 || read(ready[0], &c, 1) != 1)
+        {
+            fprintf(stderr, "Failed to join the containers\n");
+            exit(1);
+        }
+        printf("%d\n", (int)pid);
+        return 0;
+    }
+    close(ready[0]);
+    if (!freopen("/dev/null", "w", stdout))
+    {
+        exit(1);
+    }
+
+    devfd = open("/dev/mcontainer", O_RDWR);
+    if (devfd < 0)
+    {
+        fprintf(stderr, "Device open failed\n");
+        exit(1);
+    }
+    for (i = 0; i < number_of_containers; i++)
+    {
+        if (pthread_create(&thread, NULL, member_main, (void *)(long)i) != 0)
+        {
+            fprintf(stderr, "Failed to create a member thread\n");
+            exit(1);
+        }
+    }
+    pthread_mutex_lock(&mutex);
+    while (joined < number_of_containers)
+    {
+        pthread_cond_wait(&cond, &mutex);
+    }
+    pthread_mutex_unlock(&mutex);
+    c = 1;
+    if (write(ready[1], &c, 1) != 1)
+    {
+        exit(1);
+    }
+    close(ready[1]);
+    for (;;)
+    {
+        pause();
+    }
+    return 0;
+}
@@ -0,0 +1,777 @@
+//////////////////////////////////////////////////////////////////////
+//                      North Carolina State University
+//
+//
+//
+//                             Copyright 2016
+//
+////////////////////////////////////////////////////////////////////////
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms and conditions of the GNU General Public License,
+// version 2, as published by the Free Software Foundation.
+//
+// This program is distributed in the hope it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin St - Fifth Floor, Boston, MA 02110-1301 USA.
+//
+////////////////////////////////////////////////////////////////////////
+//
+//   Description:
+//     Replay Recorded Library Calls Against the Memory Container
+//
+////////////////////////////////////////////////////////////////////////
+
+#include <mcontainer.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+// Every recording file was written by one process; it is replayed by one
+// process of its own, so the original processes run side by side again.
+// Within it, the calls of every recorded thread are replayed in order by a
+// thread of their own, which also joins the containers that thread was in.
+struct recording
+{
+    const char *filename;
+    struct mcontainer_record_header header;
+    struct mcontainer_record *records;
+    size_t count;
+};
+
+// The calls one recorded thread made, and how replaying them went
+struct thread
+{
+    const struct recording *recording;
+    const char *device;
+    __u32 tid;
+    struct mcontainer_record *records;
+    size_t count;
+    __u64 epoch;
+    __u64 offset;
+    pthread_t thread;
+    int ret;
+};
+
+struct mapping
+{
+    void *data;
+    size_t size;
+};
+
+// A header mapped during replay, found again by the address the recording
+// saw for it.
+struct header
+{
+    __u64 recorded;
+    struct memory_container_object_header *header;
+};
+
+// The last generation the replay saw for an object, standing in for the
+// recorded one when a wait resumes from it.
+struct generation
+{
+    __u64 oid;
+    __u64 generation;
+};
+
+// What one replaying process carries from call to call. Imports read from
+// /dev/zero, exports go to /dev/null, and checkpoints go to a scratch file
+// that the next restore reads back.
+struct replayer
+{
+    int devfd;
+    int zero_fd;
+    int null_fd;
+    FILE *checkpoint;
+    char *buffer;
+    size_t buffer_size;
+    struct mapping *mappings;
+    size_t mapping_count;
+    struct header *headers;
+    size_t header_count;
+    struct generation *generations;
+    size_t generation_count;
+};
+
+static int fast = 0, touch = 0;
+static double speed = 1.0;
+
+static __u64 now_ns(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+static void sleep_until(__u64 deadline)
+{
+    struct timespec until;
+    until.tv_sec = deadline / 1000000000ULL;
+    until.tv_nsec = deadline % 1000000000ULL;
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &until, NULL) == EINTR)
+        ;
+}
+
+static int read_header(struct recording *recording)
+{
+    FILE *fp = fopen(recording->filename, "r");
+    int ret = -1;
+    if (!fp)
+    {
+        fprintf(stderr, "Cannot open %s\n", recording->filename);
+        return -1;
+    }
+    if (fread(&recording->header, sizeof(recording->header), 1, fp) != 1 ||
+        recording->header.magic != MCONTAINER_RECORD_MAGIC ||
+        recording->header.version != MCONTAINER_RECORD_VERSION)
+    {
+        fprintf(stderr, "%s is not a recording\n", recording->filename);
+    }
+    else
+    {
+        ret = 0;
+    }
+    fclose(fp);
+    return ret;
+}
+
+static int read_records(struct recording *recording)
+{
+    FILE *fp = fopen(recording->filename, "r");
+    struct mcontainer_record *records;
+    size_t capacity = 1024;
+    if (!fp || fseek(fp, sizeof(recording->header), SEEK_SET) != 0)
+    {
+        fprintf(stderr, "Cannot read %s\n", recording->filename);
+        return -1;
+    }
+    recording->records = malloc(capacity * sizeof(struct mcontainer_record));
+    recording->count = 0;
+    while (recording->records &&
+           fread(&recording->records[recording->count], sizeof(struct mcontainer_record), 1, fp) == 1)
+    {
+        if (++recording->count == capacity)
+        {
+            capacity *= 2;
+            if (!(records = realloc(recording->records, capacity * sizeof(struct mcontainer_record))))
+            {
+                free(recording->records);
+            }
+            recording->records = records;
+        }
+    }
+    fclose(fp);
+    if (!recording->records)
+    {
+        fprintf(stderr, "Out of memory reading %s\n", recording->filename);
+        return -1;
+    }
+    return 0;
+}
+
+static int reserve_buffer(struct replayer *replayer, size_t size)
+{
+    if (size > replayer->buffer_size)
+    {
+        free(replayer->buffer);
+        replayer->buffer_size = size;
+        if (!(replayer->buffer = calloc(1, size)))
+        {
+            replayer->buffer_size = 0;
+            return -ENOMEM;
+        }
+    }
+    return 0;
+}
+
+static __u64 *find_generation(struct replayer *replayer, __u64 oid)
+{
+    struct generation *generations;
+    size_t i;
+    for (i = 0; i < replayer->generation_count; i++)
+    {
+        if (replayer->generations[i].oid == oid)
+        {
+            return &replayer->generations[i].generation;
+        }
+    }
+    if (!(generations = realloc(replayer->generations, (i + 1) * sizeof(struct generation))))
+    {
+        return NULL;
+    }
+    replayer->generations = generations;
+    replayer->generations[i].oid = oid;
+    replayer->generations[i].generation = 0;
+    replayer->generation_count++;
+    return &replayer->generations[i].generation;
+}
+
+static long replay_alloc(struct replayer *replayer, const struct mcontainer_record *record)
+{
+    struct mapping *mappings;
+    void *data;
+    size_t i;
+    if (record->op == MCONTAINER_REC_ALLOC)
+    {
+        data = mcontainer_alloc(replayer->devfd, record->oid, record->size);
+    }
+    else
+    {
+        data = mcontainer_alloc_readonly(replayer->devfd, record->oid, record->size);
+    }
+    if (data == MAP_FAILED)
+    {
+        return -errno;
+    }
+    // the recording does not see loads and stores, -t stands in for
+    // them by faulting in every page the way a first write would
+    if (touch && record->op == MCONTAINER_REC_ALLOC)
+    {
+        for (i = 0; i < record->size; i += getpagesize())
+        {
+            ((volatile char *)data)[i] = 1;
+        }
+    }
+    if (!(mappings = realloc(replayer->mappings, (replayer->mapping_count + 1) * sizeof(struct mapping))))
+    {
+        munmap(data, record->size);
+        return -ENOMEM;
+    }
+    replayer->mappings = mappings;
+    replayer->mappings[replayer->mapping_count].data = data;
+    replayer->mappings[replayer->mapping_count].size = record->size;
+    replayer->mapping_count++;
+    return 0;
+}
+
+static long replay_header(struct replayer *replayer, const struct mcontainer_record *record)
+{
+    struct memory_container_object_header *header;
+    struct header *headers;
+    size_t i;
+    if (record->op == MCONTAINER_REC_UNMAP_HEADER)
+    {
+        for (i = 0; i < replayer->header_count; i++)
+        {
+            if (replayer->headers[i].recorded == record->arg)
+            {
+                header = replayer->headers[i].header;
+                replayer->headers[i] = replayer->headers[--replayer->header_count];
+                return mcontainer_unmap_header(header) < 0 ? -errno : 0;
+            }
+        }
+        // mapping it failed during the replay already
+        return -EINVAL;
+    }
+    if (!(header = mcontainer_map_header(replayer->devfd, record->oid)))
+    {
+        return -errno;
+    }
+    if (!(headers = realloc(replayer->headers, (replayer->header_count + 1) * sizeof(struct header))))
+    {
+        mcontainer_unmap_header(header);
+        return -ENOMEM;
+    }
+    replayer->headers = headers;
+    replayer->headers[replayer->header_count].recorded = record->arg;
+    replayer->headers[replayer->header_count].header = header;
+    replayer->header_count++;
+    return 0;
+}
+
+// Rebuilds the list of a lock set, batch or digest from the MEMBER records
+// following it. Batch buffers are laid out one after another in the
+// replay buffer.
+static long replay_list(struct replayer *replayer, const struct mcontainer_record *record,
+                        const struct mcontainer_record *members)
+{
+    struct memory_container_io *ios = NULL;
+    struct memory_container_digest *digests = NULL;
+    __u64 *oids = NULL, total = 0;
+    int count = record->size, i;
+    long ret;
+
+    switch (record->op)
+    {
+    case MCONTAINER_REC_READ_BATCH:
+    case MCONTAINER_REC_WRITE_BATCH:
+        for (i = 0; i < count; i++)
+        {
+            total += members[i].size;
+        }
+        if (reserve_buffer(replayer, total) != 0 || !(ios = calloc(count + 1, sizeof(*ios))))
+        {
+            return -ENOMEM;
+        }
+        for (i = 0, total = 0; i < count; i++)
+        {
+            ios[i].oid = members[i].oid;
+            ios[i].offset = members[i].arg;
+            ios[i].length = members[i].size;
+            ios[i].buf = (__u64)(unsigned long)(replayer->buffer + total);
+            total += members[i].size;
+        }
+        if (record->op == MCONTAINER_REC_READ_BATCH)
+        {
+            ret = mcontainer_read_batch(replayer->devfd, ios, count);
+        }
+        else
+        {
+            ret = mcontainer_write_batch(replayer->devfd, ios, count);
+        }
+        free(ios);
+        break;
+    case MCONTAINER_REC_DIGEST:
+        if (!(digests = calloc(count + 1, sizeof(*digests))))
+        {
+            return -ENOMEM;
+        }
+        for (i = 0; i < count; i++)
+        {
+            digests[i].oid = members[i].oid;
+        }
+        ret = mcontainer_digest(replayer->devfd, digests, count);
+        free(digests);
+        break;
+    default:
+        if (!(oids = calloc(count + 1, sizeof(*oids))))
+        {
+            return -ENOMEM;
+        }
+        for (i = 0; i < count; i++)
+        {
+            oids[i] = members[i].oid;
+        }
+        if (record->op == MCONTAINER_REC_LOCK_SET)
+        {
+            ret = mcontainer_lock_set(replayer->devfd, oids, count, record->arg);
+        }
+        else
+        {
+            ret = mcontainer_unlock_set(replayer->devfd, oids, count);
+        }
+        free(oids);
+    }
+    return ret < 0 ? -errno : ret;
+}
+
+// preadv/pwritev are replayed with the recorded number of equal pieces
+static long replay_vector(struct replayer *replayer, const struct mcontainer_record *record)
+{
+    struct iovec *iov;
+    int iovcnt = record->arg2 > 0 ? record->arg2 : 1, i;
+    size_t piece = record->size / iovcnt;
+    long ret;
+    if (reserve_buffer(replayer, record->size) != 0 || !(iov = calloc(iovcnt, sizeof(struct iovec))))
+    {
+        return -ENOMEM;
+    }
+    for (i = 0; i < iovcnt; i++)
+    {
+        iov[i].iov_base = replayer->buffer + i * piece;
+        iov[i].iov_len = i == iovcnt - 1 ? record->size - i * piece : piece;
+    }
+    if (record->op == MCONTAINER_REC_PREADV)
+    {
+        ret = mcontainer_preadv(replayer->devfd, record->oid, iov, iovcnt, record->arg);
+    }
+    else
+    {
+        ret = mcontainer_pwritev(replayer->devfd, record->oid, iov, iovcnt, record->arg);
+    }
+    free(iov);
+    return ret < 0 ? -errno : ret;
+}
+
+/**
+ * Issue one recorded call again and return what it returned, -errno on
+ * failure, the same way the recording keeps results. Calls on a list take
+ * their entries from the MEMBER records after them; *members is set to how
+ * many of those were consumed.
+ */
+static long replay_call(struct replayer *replayer, const struct mcontainer_record *record, size_t left, size_t *members)
+{
+    struct memory_container_stats stats;
+    struct memory_container_working_set *objects;
+    __u64 *generation, from;
+    long ret = 0;
+
+    *members = 0;
+    switch (record->op)
+    {
+    case MCONTAINER_REC_PREAD:
+    case MCONTAINER_REC_PWRITE:
+        if (reserve_buffer(replayer, record->size) != 0)
+        {
+            return -ENOMEM;
+        }
+        if (record->op == MCONTAINER_REC_PREAD)
+        {
+            ret = mcontainer_pread(replayer->devfd, record->oid, replayer->buffer, record->size, record->arg);
+        }
+        else
+        {
+            ret = mcontainer_pwrite(replayer->devfd, record->oid, replayer->buffer, record->size, record->arg);
+        }
+        break;
+    case MCONTAINER_REC_CREATE:
+        ret = record->arg ? mcontainer_create_pooled(replayer->devfd, record->cid, record->arg) : mcontainer_create(replayer->devfd, record->cid);
+        break;
+    case MCONTAINER_REC_DELETE:
+        ret = mcontainer_delete(replayer->devfd);
+        break;
+    case MCONTAINER_REC_ALLOC:
+    case MCONTAINER_REC_ALLOC_READONLY:
+        return replay_alloc(replayer, record);
+    case MCONTAINER_REC_LOCK:
+        ret = mcontainer_lock(replayer->devfd, record->oid);
+        break;
+    case MCONTAINER_REC_UNLOCK:
+        ret = mcontainer_unlock(replayer->devfd, record->oid);
+        break;
+    case MCONTAINER_REC_FREE:
+        ret = mcontainer_free(replayer->devfd, record->oid);
+        break;
+    case MCONTAINER_REC_SNAPSHOT:
+        ret = mcontainer_snapshot(replayer->devfd, record->arg);
+        break;
+    case MCONTAINER_REC_MARK_READONLY:
+        ret = mcontainer_mark_readonly(replayer->devfd, record->oid);
+        break;
+    case MCONTAINER_REC_PUBLISH:
+        ret = mcontainer_publish(replayer->devfd, record->oid);
+        break;
+    case MCONTAINER_REC_LOCK_SET:
+    case MCONTAINER_REC_UNLOCK_SET:
+    case MCONTAINER_REC_READ_BATCH:
+    case MCONTAINER_REC_WRITE_BATCH:
+    case MCONTAINER_REC_DIGEST:
+        if (record->size > left)
+        {
+            // the recording was cut short
+            *members = left;
+            return -EINVAL;
+        }
+        *members = record->size;
+        return replay_list(replayer, record, record + 1);
+    case MCONTAINER_REC_ADVISE:
+        ret = mcontainer_advise(replayer->devfd, record->oid, record->arg, record->size, record->arg2);
+        break;
+    case MCONTAINER_REC_IMPORT:
+        ret = mcontainer_import(replayer->devfd, record->oid, record->arg, replayer->zero_fd, record->size);
+        break;
+    case MCONTAINER_REC_EXPORT:
+        ret = mcontainer_export(replayer->devfd, record->oid, record->arg, replayer->null_fd, record->size);
+        break;
+    case MCONTAINER_REC_PREADV:
+    case MCONTAINER_REC_PWRITEV:
+        return replay_vector(replayer, record);
+    case MCONTAINER_REC_WAIT:
+        if (!(generation = find_generation(replayer, record->oid)))
+        {
+            return -ENOMEM;
+        }
+        // 0 and ~0 mean the same in every run, anything else is the
+        // generation the previous wait or watch on the object returned
+        from = record->arg2 == 0 || record->arg2 == ~0ULL ? record->arg2 : *generation;
+        if ((ret = mcontainer_wait(replayer->devfd, record->oid, &from, record->arg)) == 0)
+        {
+            *generation = from;
+        }
+        break;
+    case MCONTAINER_REC_WATCH:
+        if (!(generation = find_generation(replayer, record->oid)))
+        {
+            return -ENOMEM;
+        }
+        ret = mcontainer_watch(replayer->devfd, record->oid, generation);
+        break;
+    case MCONTAINER_REC_UNWATCH:
+        ret = mcontainer_unwatch(replayer->devfd, record->oid);
+        break;
+    case MCONTAINER_REC_CHECKPOINT:
+    case MCONTAINER_REC_RESTORE:
+        if (!replayer->checkpoint && !(replayer->checkpoint = tmpfile()))
+        {
+            return -errno;
+        }
+        if (record->op == MCONTAINER_REC_CHECKPOINT && ftruncate(fileno(replayer->checkpoint), 0) != 0)
+        {
+            return -errno;
+        }
+        lseek(fileno(replayer->checkpoint), 0, SEEK_SET);
+        if (record->op == MCONTAINER_REC_CHECKPOINT)
+        {
+            ret = mcontainer_checkpoint(replayer->devfd, fileno(replayer->checkpoint));
+        }
+        else
+        {
+            ret = mcontainer_restore(replayer->devfd, fileno(replayer->checkpoint));
+        }
+        break;
+    case MCONTAINER_REC_MAP_HEADER:
+    case MCONTAINER_REC_UNMAP_HEADER:
+        return replay_header(replayer, record);
+    case MCONTAINER_REC_STATS:
+        ret = mcontainer_stats(replayer->devfd, &stats);
+        break;
+    case MCONTAINER_REC_WORKING_SET:
+        if (!(objects = calloc(record->size + 1, sizeof(*objects))))
+        {
+            return -ENOMEM;
+        }
+        ret = mcontainer_working_set(replayer->devfd, objects, record->size, NULL);
+        free(objects);
+        break;
+    default:
+        // a MEMBER without its call, or an operation this replay predates
+        return -EINVAL;
+    }
+    return ret < 0 ? -errno : ret;
+}
+
+// Replays the calls of one recorded thread and prints one line of results
+static void *replay_thread(void *arg)
+{
+    struct thread *thread = arg;
+    struct replayer replayer;
+    size_t calls = 0, members, i;
+    unsigned long failed = 0, diverged = 0;
+    __u64 deadline, begin, lag, max_lag = 0, total_lag = 0;
+    char line[512];
+    int length;
+    long ret;
+
+    memset(&replayer, 0, sizeof(replayer));
+    if ((replayer.devfd = open(thread->device, O_RDWR)) < 0)
+    {
+        fprintf(stderr, "Device open failed\n");
+        thread->ret = 1;
+        return NULL;
+    }
+    replayer.zero_fd = open("/dev/zero", O_RDONLY);
+    replayer.null_fd = open("/dev/null", O_WRONLY);
+
+    sleep_until(thread->epoch + (fast ? 0 : (__u64)(thread->offset / speed)));
+    begin = now_ns();
+    for (i = 0; i < thread->count; i += 1 + members)
+    {
+        if (!fast)
+        {
+            deadline = thread->epoch + (__u64)((thread->offset + thread->records[i].time) / speed);
+            sleep_until(deadline);
+            lag = now_ns() - deadline;
+            total_lag += lag;
+            max_lag = lag > max_lag ? lag : max_lag;
+        }
+        ret = replay_call(&replayer, &thread->records[i], thread->count - i - 1, &members);
+        failed += ret < 0;
+        diverged += (ret < 0) != (thread->records[i].result < 0);
+        calls++;
+    }
+
+    // one printf per line keeps the lines of concurrent threads apart
+    length = snprintf(line, sizeof(line), "%s thread %u: %zu calls in %.3f ms, %lu failed, %lu diverged from the recording",
+                      thread->recording->filename, thread->tid, calls, (now_ns() - begin) / 1e6, failed, diverged);
+    if (!fast && calls && length > 0 && (size_t)length < sizeof(line))
+    {
+        snprintf(line + length, sizeof(line) - length, ", lag avg %.1f us max %.1f us", total_lag / 1e3 / calls, max_lag / 1e3);
+    }
+    printf("%s\n", line);
+
+    for (i = 0; i < replayer.mapping_count; i++)
+    {
+        munmap(replayer.mappings[i].data, replayer.mappings[i].size);
+    }
+    for (i = 0; i < replayer.header_count; i++)
+    {
+        mcontainer_unmap_header(replayer.headers[i].header);
+    }
+    if (replayer.checkpoint)
+    {
+        fclose(replayer.checkpoint);
+    }
+    free(replayer.mappings);
+    free(replayer.headers);
+    free(replayer.generations);
+    free(replayer.buffer);
+    close(replayer.zero_fd);
+    close(replayer.null_fd);
+    close(replayer.devfd);
+    return NULL;
+}
+
+/**
+ * Replay one recording, starting at epoch, with one thread per recorded
+ * thread. Returns 0 unless the recording could not be replayed at all.
+ */
+static int replay(struct recording *recording, const char *device, __u64 epoch, __u64 first_start)
+{
+    struct thread *threads = NULL, *grown;
+    struct mcontainer_record *records;
+    size_t thread_count = 0, started = 0, i, j;
+    int ret = 0;
+
+    if (read_records(recording) != 0)
+    {
+        return 1;
+    }
+    // split the records by thread, MEMBER records stay behind their call
+    for (i = 0; i < recording->count; i++)
+    {
+        for (j = 0; j < thread_count && threads[j].tid != recording->records[i].tid; j++)
+            ;
+        if (j == thread_count)
+        {
+            if (!(grown = realloc(threads, (thread_count + 1) * sizeof(struct thread))))
+            {
+                ret = 1;
+                break;
+            }
+            threads = grown;
+            memset(&threads[j], 0, sizeof(struct thread));
+            threads[j].recording = recording;
+            threads[j].device = device;
+            threads[j].tid = recording->records[i].tid;
+            threads[j].epoch = epoch;
+            threads[j].offset = recording->header.start - first_start;
+            thread_count++;
+        }
+        if (!(records = realloc(threads[j].records, (threads[j].count + 1) * sizeof(struct mcontainer_record))))
+        {
+            ret = 1;
+            break;
+        }
+        threads[j].records = records;
+        threads[j].records[threads[j].count++] = recording->records[i];
+    }
+    if (ret != 0)
+    {
+        fprintf(stderr, "Out of memory splitting %s\n", recording->filename);
+    }
+    else if (thread_count == 0)
+    {
+        printf("%s: no calls\n", recording->filename);
+    }
+    for (; ret == 0 && started < thread_count; started++)
+    {
+        if (pthread_create(&threads[started].thread, NULL, replay_thread, &threads[started]) != 0)
+        {
+            fprintf(stderr, "Cannot start a thread for %s\n", recording->filename);
+            ret = 1;
+            break;
+        }
+    }
+    for (j = 0; j < thread_count; j++)
+    {
+        if (j < started)
+        {
+            pthread_join(threads[j].thread, NULL);
+            ret |= threads[j].ret;
+        }
+        free(threads[j].records);
+    }
+    free(threads);
+    free(recording->records);
+    return ret;
+}
+
+int main(int argc, char *argv[])
+{
+    const char *device = "/dev/mcontainer";
+    struct recording *recordings;
+    __u64 first_start = ~0ULL, epoch, begin;
+    int count, i, opt, stat, ret = 0;
+    pid_t *pid;
+
+    // replaying must not record itself when run with MCONTAINER_RECORD set
+    mcontainer_record_stop();
+
+    while ((opt = getopt(argc, argv, "fs:td:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'f':
+            fast = 1;
+            break;
+        case 's':
+            speed = atof(optarg);
+            break;
+        case 't':
+            touch = 1;
+            break;
+        case 'd':
+            device = optarg;
+            break;
+        default:
+            optind = argc + 1;
+        }
+    }
+    if (optind >= argc || speed <= 0)
+    {
+        fprintf(stderr, "Usage: %s [-f] [-s speed] [-t] [-d device] recording...\n", argv[0]);
+        fprintf(stderr, "  -f  issue calls as fast as possible instead of at their recorded times\n");
+        fprintf(stderr, "  -s  scale recorded time, 2 replays twice as fast\n");
+        fprintf(stderr, "  -t  write every page of an object after mapping it\n");
+        exit(1);
+    }
+
+    count = argc - optind;
+    recordings = calloc(count, sizeof(struct recording));
+    pid = calloc(count, sizeof(pid_t));
+    for (i = 0; i < count; i++)
+    {
+        recordings[i].filename = argv[optind + i];
+        if (read_header(&recordings[i]) != 0)
+        {
+            exit(1);
+        }
+        if (recordings[i].header.start < first_start)
+        {
+            first_start = recordings[i].header.start;
+        }
+    }
+
+    // give every replayer time to load its recording before the clock starts
+    epoch = now_ns() + 200000000ULL + count * 1000000ULL;
+    fflush(stdout);
+    for (i = 0; i < count; i++)
+    {
+        if ((pid[i] = fork()) == 0)
+        {
+            exit(replay(&recordings[i], device, epoch, first_start));
+        }
+        if (pid[i] < 0)
+        {
+            fprintf(stderr, "fork failed\n");
+            ret = 1;
+        }
+    }
+    for (i = 0; i < count; i++)
+    {
+        if (pid[i] > 0 && (waitpid(pid[i], &stat, 0) < 0 || !WIFEXITED(stat) || WEXITSTATUS(stat) != 0))
+        {
+            ret = 1;
+        }
+    }
+    begin = now_ns();
+    printf("replayed %d recordings in %.3f ms\n", count, begin > epoch ? (begin - epoch) / 1e6 : 0.0);
+
+    free(pid);
+    free(recordings);
+    return ret;
+}
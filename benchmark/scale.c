@@ -0,0 +1,653 @@
+//////////////////////////////////////////////////////////////////////
+//                      North Carolina State University
+//
+//
+//
+//                             Copyright 2016
+//
+////////////////////////////////////////////////////////////////////////
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms and conditions of the GNU General Public License,
+// version 2, as published by the Free Software Foundation.
+//
+// This program is distributed in the hope it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin St - Fifth Floor, Boston, MA 02110-1301 USA.
+//
+////////////////////////////////////////////////////////////////////////
+//
+//   Description:
+//     Scalability Microbenchmark of the ioctl and mmap Paths
+//
+////////////////////////////////////////////////////////////////////////
+
+#include <mcontainer.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+// One configuration is measured with everything below already in place:
+// containers containers in total, the measured one holding tasks tasks and
+// objects objects. processes x threads measuring tasks then join it and
+// time every call of iterations rounds of
+//     create, lock, alloc, unlock, lock, free, unlock, delete
+// on an object of their own. Each dimension is swept on its own while the
+// others stay at their first value. Failed calls are counted per op,
+// including the untimed lock and unlock around free, and fail the run.
+#define DIMENSIONS 5
+#define MAX_VALUES 32
+#define OPS 6
+
+enum { OP_CREATE, OP_LOCK, OP_ALLOC, OP_UNLOCK, OP_FREE, OP_DELETE };
+
+static const char *op_names[OPS] = { "create", "lock", "alloc", "unlock", "free", "delete" };
+static const char *dimension_names[DIMENSIONS] = { "containers", "tasks", "objects", "processes", "threads" };
+
+struct sweep
+{
+    int values[MAX_VALUES];
+    int count;
+};
+
+struct config
+{
+    int value[DIMENSIONS];
+};
+
+struct result
+{
+    int dimension;
+    struct config config;
+    int op;
+    unsigned long calls;
+    unsigned long failed;
+    double mean;
+    unsigned long long p50, p99;
+};
+
+// Tasks that only keep containers populated while a configuration runs
+struct filler
+{
+    pthread_t thread;
+    int cid;
+};
+
+static int devfd, iterations = 1000, object_size;
+static int fillers_ready;
+static int fillers_stop;
+static pthread_mutex_t filler_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t filler_cond = PTHREAD_COND_INITIALIZER;
+
+// Shared with the measuring processes
+static volatile int *go;
+static unsigned long long *samples;
+static unsigned long *failures;
+
+static unsigned long long now_ns(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+static int parse_sweep(const char *list, struct sweep *sweep)
+{
+    char *copy = strdup(list), *token, *save = NULL;
+    sweep->count = 0;
+    for (token = strtok_r(copy, ",", &save); token && sweep->count < MAX_VALUES; token = strtok_r(NULL, ",", &save))
+    {
+        sweep->values[sweep->count++] = atoi(token);
+    }
+    free(copy);
+    return sweep->count;
+}
+
+static void *filler_main(void *arg)
+{
+    struct filler *filler = arg;
+    mcontainer_create(devfd, filler->cid);
+    pthread_mutex_lock(&filler_mutex);
+    fillers_ready++;
+    pthread_cond_broadcast(&filler_cond);
+    while (!fillers_stop)
+    {
+        pthread_cond_wait(&filler_cond, &filler_mutex);
+    }
+    pthread_mutex_unlock(&filler_mutex);
+    mcontainer_delete(devfd);
+    return NULL;
+}
+
+struct measurer
+{
+    pthread_t thread;
+    int index;
+    int cid;
+};
+
+static void count_failure(int op, int failed)
+{
+    if (failed)
+    {
+        __atomic_fetch_add(&failures[op], 1, __ATOMIC_RELAXED);
+    }
+}
+
+static void *measurer_main(void *arg)
+{
+    struct measurer *measurer = arg;
+    unsigned long long *sample = samples + (size_t)measurer->index * iterations * OPS, t;
+    __u64 oid = (1ULL << 24) + measurer->index;
+    void *data;
+    int i, ret;
+
+    while (!*go)
+    {
+        sched_yield();
+    }
+    for (i = 0; i < iterations; i++, sample += OPS)
+    {
+        t = now_ns();
+        ret = mcontainer_create(devfd, measurer->cid);
+        sample[OP_CREATE] = now_ns() - t;
+        count_failure(OP_CREATE, ret != 0);
+
+        t = now_ns();
+        ret = mcontainer_lock(devfd, oid);
+        sample[OP_LOCK] = now_ns() - t;
+        count_failure(OP_LOCK, ret != 0);
+
+        t = now_ns();
+        data = mcontainer_alloc(devfd, oid, object_size);
+        sample[OP_ALLOC] = now_ns() - t;
+        count_failure(OP_ALLOC, data == MAP_FAILED);
+
+        t = now_ns();
+        ret = mcontainer_unlock(devfd, oid);
+        sample[OP_UNLOCK] = now_ns() - t;
+        count_failure(OP_UNLOCK, ret != 0);
+
+        count_failure(OP_LOCK, mcontainer_lock(devfd, oid) != 0);
+        t = now_ns();
+        ret = mcontainer_free(devfd, oid);
+        sample[OP_FREE] = now_ns() - t;
+        count_failure(OP_FREE, ret != 0);
+        count_failure(OP_UNLOCK, mcontainer_unlock(devfd, oid) != 0);
+        if (data != MAP_FAILED)
+        {
+            munmap(data, object_size);
+        }
+
+        t = now_ns();
+        ret = mcontainer_delete(devfd);
+        sample[OP_DELETE] = now_ns() - t;
+        count_failure(OP_DELETE, ret != 0);
+    }
+    return NULL;
+}
+
+static void measure_process(int process, int threads, int cid)
+{
+    struct measurer *measurers = calloc(threads, sizeof(struct measurer));
+    int i;
+    for (i = 0; i < threads; i++)
+    {
+        measurers[i].index = process * threads + i;
+        measurers[i].cid = cid;
+        pthread_create(&measurers[i].thread, NULL, measurer_main, &measurers[i]);
+    }
+    for (i = 0; i < threads; i++)
+    {
+        pthread_join(measurers[i].thread, NULL);
+    }
+    free(measurers);
+}
+
+static int compare_samples(const void *a, const void *b)
+{
+    unsigned long long x = *(const unsigned long long *)a, y = *(const unsigned long long *)b;
+    return x < y ? -1 : x > y;
+}
+
+/**
+ * Set up one configuration, let its measurers loose and summarize what
+ * they measured into results[0..OPS). Returns 0 on success.
+ */
+static int run_config(int dimension, const struct config *config, int cid, struct result *results)
+{
+    int containers = config->value[0], tasks = config->value[1], objects = config->value[2];
+    int processes = config->value[3], threads = config->value[4];
+    int fillers_count = (containers - 1) + (tasks - 1), measurers = processes * threads;
+    struct filler *fillers = calloc(fillers_count > 0 ? fillers_count : 1, sizeof(struct filler));
+    size_t calls = (size_t)measurers * iterations, i;
+    unsigned long long *sorted = malloc(calls * sizeof(unsigned long long));
+    pid_t *pid = calloc(processes, sizeof(pid_t));
+    void *data;
+    int op, j, stat, ret = 0;
+
+    samples = mmap(NULL, calls * OPS * sizeof(unsigned long long), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    failures = mmap(NULL, OPS * sizeof(unsigned long), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (!fillers || !sorted || !pid || samples == MAP_FAILED || failures == MAP_FAILED)
+    {
+        fprintf(stderr, "Out of memory\n");
+        exit(1);
+    }
+
+    // this thread keeps the measured container alive and fills it with objects
+    mcontainer_create(devfd, cid);
+    for (j = 0; j < objects; j++)
+    {
+        if ((data = mcontainer_alloc(devfd, j, object_size)) != MAP_FAILED)
+        {
+            munmap(data, object_size);
+        }
+    }
+    fillers_ready = 0;
+    fillers_stop = 0;
+    for (j = 0; j < fillers_count; j++)
+    {
+        // the other containers first, then the measured one's extra tasks
+        fillers[j].cid = j < containers - 1 ? cid + 1 + j : cid;
+        pthread_create(&fillers[j].thread, NULL, filler_main, &fillers[j]);
+    }
+    pthread_mutex_lock(&filler_mutex);
+    while (fillers_ready < fillers_count)
+    {
+        pthread_cond_wait(&filler_cond, &filler_mutex);
+    }
+    pthread_mutex_unlock(&filler_mutex);
+
+    *go = 0;
+    fflush(stdout);
+    for (j = 0; j < processes; j++)
+    {
+        if ((pid[j] = fork()) == 0)
+        {
+            measure_process(j, threads, cid);
+            _exit(0);
+        }
+    }
+    *go = 1;
+    for (j = 0; j < processes; j++)
+    {
+        if (pid[j] < 0 || waitpid(pid[j], &stat, 0) < 0 || !WIFEXITED(stat) || WEXITSTATUS(stat) != 0)
+        {
+            ret = -1;
+        }
+    }
+
+    pthread_mutex_lock(&filler_mutex);
+    fillers_stop = 1;
+    pthread_cond_broadcast(&filler_cond);
+    pthread_mutex_unlock(&filler_mutex);
+    for (j = 0; j < fillers_count; j++)
+    {
+        pthread_join(fillers[j].thread, NULL);
+    }
+    mcontainer_delete(devfd);
+
+    for (op = 0; op < OPS; op++)
+    {
+        double sum = 0;
+        for (i = 0; i < calls; i++)
+        {
+            sorted[i] = samples[i * OPS + op];
+            sum += sorted[i];
+        }
+        qsort(sorted, calls, sizeof(unsigned long long), compare_samples);
+        results[op].dimension = dimension;
+        results[op].config = *config;
+        results[op].op = op;
+        results[op].calls = calls;
+        results[op].failed = failures[op];
+        results[op].mean = calls ? sum / calls : 0;
+        results[op].p50 = calls ? sorted[calls / 2] : 0;
+        results[op].p99 = calls ? sorted[calls * 99 / 100] : 0;
+    }
+
+    munmap(samples, calls * OPS * sizeof(unsigned long long));
+    munmap(failures, OPS * sizeof(unsigned long));
+    free(pid);
+    free(sorted);
+    free(fillers);
+    return ret;
+}
+
+static void print_result(const struct result *result, int json, int first)
+{
+    const struct config *config = &result->config;
+    if (json)
+    {
+        printf("%s  {\"dimension\": \"%s\", \"containers\": %d, \"tasks\": %d, \"objects\": %d, \"processes\": %d, "
+               "\"threads\": %d, \"op\": \"%s\", \"calls\": %lu, \"failed\": %lu, \"mean_ns\": %.1f, \"p50_ns\": %llu, "
+               "\"p99_ns\": %llu}",
+               first ? "" : ",\n", dimension_names[result->dimension], config->value[0], config->value[1], config->value[2],
+               config->value[3], config->value[4], op_names[result->op], result->calls, result->failed, result->mean,
+               result->p50, result->p99);
+    }
+    else
+    {
+        printf("%s,%d,%d,%d,%d,%d,%s,%lu,%lu,%.1f,%llu,%llu\n", dimension_names[result->dimension], config->value[0],
+               config->value[1], config->value[2], config->value[3], config->value[4], op_names[result->op],
+               result->calls, result->failed, result->mean, result->p50, result->p99);
+    }
+    fflush(stdout);
+}
+
+/**
+ * Growth of every op along every sweep, as the exponent k in
+ * p50 ~ value^k between the smallest and largest value: 0 is flat, 1
+ * linear. Anything well above 1 is printed as superlinear.
+ */
+static void print_growth(const struct result *results, int count)
+{
+    int dimension, op, i, first, last;
+    double exponent;
+    for (dimension = 0; dimension < DIMENSIONS; dimension++)
+    {
+        for (op = 0; op < OPS; op++)
+        {
+            first = last = -1;
+            for (i = 0; i < count; i++)
+            {
+                // a sweep from 0 objects is judged from its first nonzero point
+                if (results[i].dimension != dimension || results[i].op != op || results[i].config.value[dimension] <= 0)
+                {
+                    continue;
+                }
+                if (first < 0 || results[i].config.value[dimension] < results[first].config.value[dimension])
+                {
+                    first = i;
+                }
+                if (last < 0 || results[i].config.value[dimension] > results[last].config.value[dimension])
+                {
+                    last = i;
+                }
+            }
+            if (first < 0 || results[last].config.value[dimension] == results[first].config.value[dimension] ||
+                results[first].p50 == 0 || results[last].p50 == 0)
+            {
+                continue;
+            }
+            exponent = log((double)results[last].p50 / results[first].p50) /
+                       log((double)results[last].config.value[dimension] / results[first].config.value[dimension]);
+            fprintf(stderr, "%-10s %-7s %6d -> %-6d p50 %8llu -> %-8llu ns  growth %5.2f%s\n",
+                    dimension_names[dimension], op_names[op], results[first].config.value[dimension],
+                    results[last].config.value[dimension], results[first].p50, results[last].p50, exponent,
+                    exponent > 1.2 ? "  superlinear" : "");
+        }
+    }
+}
+
+/**
+ * Compare results against a CSV written by an earlier run and report
+ * every op whose p50 grew by more than threshold. Returns the number of
+ * regressions.
+ */
+// Scans the value of "key" in one result object of -j output with format
+static int json_value(const char *line, const char *key, const char *format, void *value)
+{
+    char pattern[40];
+    const char *at;
+    snprintf(pattern, sizeof(pattern), "\"%s\":", key);
+    if (!(at = strstr(line, pattern)))
+    {
+        return 0;
+    }
+    return sscanf(at + strlen(pattern), format, value) == 1;
+}
+
+/**
+ * Parse one line of a baseline written by an earlier run, CSV or JSON, and
+ * return whether it held a result. JSON is read as -j writes it, one
+ * result object per line.
+ */
+static int parse_baseline(const char *filename, const char *line, char *dimension, char *op, struct config *config,
+                          unsigned long long *p50)
+{
+    unsigned long calls, failed;
+    double mean;
+    unsigned long long p99;
+    const char *object = strchr(line, '{');
+    int d;
+
+    if (object)
+    {
+        if (strchr(object + 1, '{'))
+        {
+            fprintf(stderr, "baseline %s: expected one JSON result per line, as written by -j\n", filename);
+            exit(1);
+        }
+        if (!json_value(object, "dimension", " \"%31[^\"]", dimension) || !json_value(object, "op", " \"%31[^\"]", op) ||
+            !json_value(object, "p50_ns", " %llu", p50))
+        {
+            return 0;
+        }
+        for (d = 0; d < DIMENSIONS; d++)
+        {
+            // the config columns are named after the dimensions
+            if (!json_value(object, dimension_names[d], " %d", &config->value[d]))
+            {
+                return 0;
+            }
+        }
+        return 1;
+    }
+    // baselines from before the failed column have one field less
+    return sscanf(line, "%31[^,],%d,%d,%d,%d,%d,%31[^,],%lu,%lu,%lf,%llu,%llu", dimension, &config->value[0],
+                  &config->value[1], &config->value[2], &config->value[3], &config->value[4], op, &calls, &failed, &mean,
+                  p50, &p99) == 12 ||
+           sscanf(line, "%31[^,],%d,%d,%d,%d,%d,%31[^,],%lu,%lf,%llu,%llu", dimension, &config->value[0],
+                  &config->value[1], &config->value[2], &config->value[3], &config->value[4], op, &calls, &mean, p50,
+                  &p99) == 11;
+}
+
+static int compare_baseline(const char *filename, const struct result *results, int count, double threshold)
+{
+    FILE *fp = fopen(filename, "r");
+    char line[512], dimension[32], op[32];
+    struct config config;
+    unsigned long long p50;
+    int i, matched = 0, regressions = 0;
+
+    if (!fp)
+    {
+        fprintf(stderr, "Cannot open baseline %s\n", filename);
+        exit(1);
+    }
+    while (fgets(line, sizeof(line), fp))
+    {
+        memset(&config, 0, sizeof(config));
+        if (!parse_baseline(filename, line, dimension, op, &config, &p50))
+        {
+            continue;
+        }
+        for (i = 0; i < count; i++)
+        {
+            if (strcmp(dimension_names[results[i].dimension], dimension) != 0 || strcmp(op_names[results[i].op], op) != 0 ||
+                memcmp(&results[i].config, &config, sizeof(config)) != 0)
+            {
+                continue;
+            }
+            matched++;
+            if (p50 > 0 && results[i].p50 > p50 * threshold)
+            {
+                fprintf(stderr, "regression: %s %d/%d/%d/%d/%d %s p50 %llu -> %llu ns (%.2fx)\n", dimension,
+                        config.value[0], config.value[1], config.value[2], config.value[3], config.value[4], op, p50,
+                        results[i].p50, (double)results[i].p50 / p50);
+                regressions++;
+            }
+        }
+    }
+    fclose(fp);
+    fprintf(stderr, "%d results compared with %s, %d regressions over %.2fx\n", matched, filename, regressions, threshold);
+    return regressions;
+}
+
+int main(int argc, char *argv[])
+{
+    const char *device = "/dev/mcontainer", *baseline = NULL;
+    struct sweep sweeps[DIMENSIONS];
+    struct result *results;
+    struct config config;
+    double threshold = 1.5;
+    int json = 0, bad = 0, opt, dimension, i, count = 0, total = 0, base_cid, regressions = 0;
+    unsigned long failed = 0;
+
+    parse_sweep("1,4,16,64,256", &sweeps[0]);
+    parse_sweep("1,4,16,64,256", &sweeps[1]);
+    parse_sweep("0,16,256,4096", &sweeps[2]);
+    parse_sweep("1,2,4", &sweeps[3]);
+    parse_sweep("1,2,4", &sweeps[4]);
+
+    while ((opt = getopt(argc, argv, "c:t:o:p:w:i:s:jb:r:d:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'c':
+            parse_sweep(optarg, &sweeps[0]);
+            break;
+        case 't':
+            parse_sweep(optarg, &sweeps[1]);
+            break;
+        case 'o':
+            parse_sweep(optarg, &sweeps[2]);
+            break;
+        case 'p':
+            parse_sweep(optarg, &sweeps[3]);
+            break;
+        case 'w':
+            parse_sweep(optarg, &sweeps[4]);
+            break;
+        case 'i':
+            iterations = atoi(optarg);
+            break;
+        case 's':
+            object_size = atoi(optarg);
+            break;
+        case 'j':
+            json = 1;
+            break;
+        case 'b':
+            baseline = optarg;
+            break;
+        case 'r':
+            threshold = atof(optarg);
+            break;
+        case 'd':
+            device = optarg;
+            break;
+        default:
+            bad = 1;
+        }
+    }
+    for (dimension = 0; dimension < DIMENSIONS; dimension++)
+    {
+        for (i = 0; i < sweeps[dimension].count; i++)
+        {
+            // at least one container, task, process and thread; objects may be 0
+            if (sweeps[dimension].values[i] < (dimension == 2 ? 0 : 1) || sweeps[dimension].values[i] > 65535)
+            {
+                bad = 1;
+            }
+        }
+        bad |= sweeps[dimension].count == 0;
+    }
+    if (bad || optind != argc || iterations <= 0 || threshold <= 0)
+    {
+        fprintf(stderr, "Usage: %s [-c containers] [-t tasks] [-o objects] [-p processes] [-w threads]\n", argv[0]);
+        fprintf(stderr, "       [-i iterations] [-s object_size] [-j] [-b baseline] [-r threshold] [-d device]\n");
+        fprintf(stderr, "  each sweep is a list such as 1,16,256; the others stay at their first value\n");
+        fprintf(stderr, "  -j  print JSON instead of CSV\n");
+        fprintf(stderr, "  -b  compare with the CSV or JSON of an earlier run and fail on p50 regressions over -r (1.5)\n");
+        exit(1);
+    }
+    if (object_size <= 0)
+    {
+        object_size = getpagesize();
+    }
+
+    devfd = open(device, O_RDWR);
+    if (devfd < 0)
+    {
+        fprintf(stderr, "Device open failed\n");
+        exit(1);
+    }
+    go = mmap(NULL, sizeof(int), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    for (dimension = 0; dimension < DIMENSIONS; dimension++)
+    {
+        total += sweeps[dimension].count;
+    }
+    results = calloc((size_t)total * OPS, sizeof(struct result));
+    if (go == MAP_FAILED || !results)
+    {
+        fprintf(stderr, "Out of memory\n");
+        exit(1);
+    }
+
+    // cids of this run stay clear of other users of the device
+    base_cid = (getpid() & 0x3fff) << 16;
+    if (json)
+    {
+        printf("[\n");
+    }
+    else
+    {
+        printf("dimension,containers,tasks,objects,processes,threads,op,calls,failed,mean_ns,p50_ns,p99_ns\n");
+    }
+    for (dimension = 0; dimension < DIMENSIONS; dimension++)
+    {
+        for (i = 0; i < sweeps[dimension].count; i++)
+        {
+            int d, op;
+            for (d = 0; d < DIMENSIONS; d++)
+            {
+                config.value[d] = sweeps[d].values[0];
+            }
+            config.value[dimension] = sweeps[dimension].values[i];
+            if (run_config(dimension, &config, base_cid, &results[count]) != 0)
+            {
+                fprintf(stderr, "A measuring process failed\n");
+                exit(1);
+            }
+            for (op = 0; op < OPS; op++, count++)
+            {
+                print_result(&results[count], json, count == 0);
+                failed += results[count].failed;
+            }
+        }
+    }
+    if (json)
+    {
+        printf("\n]\n");
+    }
+
+    print_growth(results, count);
+    if (baseline)
+    {
+        regressions = compare_baseline(baseline, results, count, threshold);
+    }
+    free(results);
+    close(devfd);
+    if (failed)
+    {
+        fprintf(stderr, "%lu calls failed, see the failed column\n", failed);
+        return 1;
+    }
+    return regressions ? 2 : 0;
+}
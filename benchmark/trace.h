@@ -0,0 +1,78 @@
+//////////////////////////////////////////////////////////////////////
+//                      North Carolina State University
+//
+//
+//
+//                             Copyright 2016
+//
+////////////////////////////////////////////////////////////////////////
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms and conditions of the GNU General Public License,
+// version 2, as published by the Free Software Foundation.
+//
+// This program is distributed in the hope it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin St - Fifth Floor, Boston, MA 02110-1301 USA.
+//
+////////////////////////////////////////////////////////////////////////
+//
+//   Description:
+//     Binary Trace Format Shared by Benchmark and Validate
+//
+////////////////////////////////////////////////////////////////////////
+
+#ifndef MCONTAINER_TRACE_H
+#define MCONTAINER_TRACE_H
+
+#include <linux/types.h>
+#include <string.h>
+
+// Every process writes mcontainer.<pid>.trace: one trace_header followed by
+// fixed-size trace_records in the order the process did them. Contents are
+// not logged, only a hash of the string stored in the object.
+#define TRACE_MAGIC 0x4543415254434dULL
+#define TRACE_VERSION 1
+
+#define TRACE_OP_SET 'S'
+#define TRACE_OP_DELETE 'D'
+
+struct trace_header
+{
+    __u64 magic;
+    __u64 version;
+};
+
+struct trace_record
+{
+    __u64 time;
+    __u32 pid;
+    __u32 cid;
+    __u64 oid;
+    __u32 op;
+    __u32 size;
+    __u64 hash;
+};
+
+/**
+ * FNV-1a over the string held in an object, stopping at the first NUL or
+ * after size bytes. An all-zero object hashes like the empty string.
+ */
+static inline __u64 trace_hash(const char *data, size_t size)
+{
+    __u64 hash = 0xcbf29ce484222325ULL;
+    size_t i;
+    for (i = 0; i < size && data[i] != '\0'; i++)
+    {
+        hash ^= (unsigned char)data[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+#endif
@@ -39,23 +39,129 @@
 #include <unistd.h>
 #include <string.h>
 #include <sys/wait.h>
+#include "trace.h"
 
+// One open per-process trace and the record it is positioned at.
+struct trace_cursor
+{
+    FILE *fp;
+    int index;
+    struct trace_record record;
+};
+
+static int open_trace(const char *path, int index, struct trace_cursor *cursor)
+{
+    struct trace_header header;
+    cursor->fp = strcmp(path, "-") == 0 ? stdin : fopen(path, "r");
+    cursor->index = index;
+    if (!cursor->fp)
+    {
+        fprintf(stderr, "Cannot open trace %s\n", path);
+        return -1;
+    }
+    if (fread(&header, sizeof(header), 1, cursor->fp) != 1 || header.magic != TRACE_MAGIC || header.version != TRACE_VERSION)
+    {
+        fprintf(stderr, "%s is not a version %d trace\n", path, TRACE_VERSION);
+        fclose(cursor->fp);
+        return -1;
+    }
+    return 0;
+}
+
+static int next_record(struct trace_cursor *cursor)
+{
+    return fread(&cursor->record, sizeof(cursor->record), 1, cursor->fp) == 1;
+}
+
+// Records are merged by timestamp; equal timestamps keep the order of the
+// traces on the command line, and a single trace is never reordered.
+static int cursor_before(const struct trace_cursor *a, const struct trace_cursor *b)
+{
+    if (a->record.time != b->record.time)
+    {
+        return a->record.time < b->record.time;
+    }
+    return a->index < b->index;
+}
+
+static void sift_down(struct trace_cursor **heap, int count, int i)
+{
+    for (;;)
+    {
+        int first = i, left = 2 * i + 1, right = 2 * i + 2;
+        struct trace_cursor *swap;
+        if (left < count && cursor_before(heap[left], heap[first]))
+        {
+            first = left;
+        }
+        if (right < count && cursor_before(heap[right], heap[first]))
+        {
+            first = right;
+        }
+        if (first == i)
+        {
+            return;
+        }
+        swap = heap[i];
+        heap[i] = heap[first];
+        heap[first] = swap;
+        i = first;
+    }
+}
+
+/**
+ * Hash every object of container cid through a live mapping and compare it
+ * with the hash the replayed trace left for it.
+ */
+static int check_container(int devfd, int cid, int number_of_objects, int max_size_of_objects, const __u64 *expected)
+{
+    int i, error = 0;
+    char *mapped_data;
+    __u64 hash;
+
+    mcontainer_create(devfd, cid);
+    for (i = 0; i < number_of_objects; i++)
+    {
+        mapped_data = (char *)mcontainer_alloc(devfd, i, max_size_of_objects);
+        if (mapped_data == MAP_FAILED)
+        {
+            fprintf(stderr, "Container %d Object %d cannot be mapped\n", cid, i);
+            error++;
+            continue;
+        }
+        hash = trace_hash(mapped_data, max_size_of_objects);
+        if (hash != expected[i])
+        {
+            fprintf(stderr, "Container %d Object %d has a wrong value %.32s... (hash %016llx v.s. %016llx)\n", cid, i, mapped_data, (unsigned long long)hash, (unsigned long long)expected[i]);
+            error++;
+        }
+        munmap(mapped_data, max_size_of_objects);
+    }
+
+    if (error == 0)
+    {
+        fprintf(stderr, "Container %d Pass\n", cid);
+    }
+    mcontainer_delete(devfd);
+    return error;
+}
 
 int main(int argc, char *argv[])
 {
-    int i = 0, j = 0, error = 0;
+    int i = 0, j = 0, count = 0, failed = 0;
     int number_of_objects = 1024, max_size_of_objects = 8192, number_of_containers = 1;
-    int child_pid, cid, stat, devfd;
-    long size;
-    __u64 object_id, current_time;
-    char *data, op, *mapped_data;
-    char ***containers;
+    int stat, devfd;
+    __u64 *expected, empty = trace_hash("", 0);
+    struct trace_cursor *cursors, **heap;
+    struct trace_record *record;
+    char *stdin_trace[] = { "-" }, **traces;
+    int number_of_traces;
     pid_t *pid;
 
     // takes arguments from command line interface.
-    if (argc < 3)
+    if (argc < 4)
     {
-        fprintf(stderr, "Usage: %s number_of_objects max_size_of_objects number_of_containers\n", argv[0]);
+        fprintf(stderr, "Usage: %s number_of_objects max_size_of_objects number_of_containers [trace ...]\n", argv[0]);
         exit(1);
     }
 
@@ -63,99 +169,98 @@ int main(int argc, char *argv[])
     max_size_of_objects = atoi(argv[2]);
     number_of_containers = atoi(argv[3]);
 
-    pid = (pid_t *) calloc(number_of_containers - 1, sizeof(pid_t));
-
-    // allocate memory spaces
-    data = (char *)malloc(max_size_of_objects * sizeof(char));
-    containers = (char ***)calloc(number_of_containers, sizeof(char **));
+    // without trace files read a single trace from stdin
+    traces = argc > 4 ? argv + 4 : stdin_trace;
+    number_of_traces = argc > 4 ? argc - 4 : 1;
 
-    for (i = 0; i < number_of_containers; i++)
+    // only the expected hash of every object is kept, not its contents
+    pid = (pid_t *) calloc(number_of_containers, sizeof(pid_t));
+    expected = (__u64 *)malloc((size_t)number_of_containers * number_of_objects * sizeof(__u64));
+    cursors = (struct trace_cursor *)calloc(number_of_traces, sizeof(struct trace_cursor));
+    heap = (struct trace_cursor **)calloc(number_of_traces, sizeof(struct trace_cursor *));
+    for (i = 0; i < number_of_containers * number_of_objects; i++)
     {
-        containers[i] = (char **)calloc(number_of_objects, sizeof(char *));
-        for (j = 0; j < number_of_objects; j++)
-        {
-            containers[i][j] = (char *)malloc(max_size_of_objects * sizeof(char));
-            memset(containers[i][j], 0, max_size_of_objects);
-        }
+        expected[i] = empty;
     }
 
-    // Replay the log to validate the results in containers.
-    while (scanf("%c %d %d %llu %llu %ld %s", &op, &child_pid, &cid, &current_time, &object_id, &size, &data[0]) != EOF)
+    for (i = 0; i < number_of_traces; i++)
     {
-        if (op == 'S')
+        if (open_trace(traces[i], i, &cursors[i]) != 0)
+        {
+            exit(1);
+        }
+        if (next_record(&cursors[i]))
         {
-            strcpy(containers[cid][(int)object_id], data);
-            memset(data, 0, max_size_of_objects);
+            heap[count++] = &cursors[i];
         }
-        else if (op == 'D')
+        else
         {
-            memset(containers[cid][(int)object_id], 0, max_size_of_objects);
+            fclose(cursors[i].fp);
         }
     }
 
-    // open the container kernel module to check the results.
-    devfd = open("/dev/mcontainer", O_RDWR);
-    if (devfd < 0)
+    // Replay the traces merged by timestamp, holding one record per trace.
+    for (i = count / 2 - 1; i >= 0; i--)
     {
-        fprintf(stderr, "Device open failed");
-        exit(1);
+        sift_down(heap, count, i);
     }
-
-    // parent process forks children to validate the results in containers.
-    for (i = 0; i < (number_of_containers - 1) && pid != 0; i++)
+    while (count > 0)
     {
-        child_pid = fork();
-        if (child_pid == 0)
+        record = &heap[0]->record;
+        if (record->cid >= (__u32)number_of_containers || record->oid >= (__u64)number_of_objects)
         {
-            break;
+            fprintf(stderr, "Trace of pid %u has container %u object %llu out of range\n", record->pid, record->cid, (unsigned long long)record->oid);
+            failed++;
         }
-        else
+        else if (record->op == TRACE_OP_SET)
         {
-            pid[i] = child_pid;
-        }    
-    }
-
-    cid = getpid() % number_of_containers;
-    mcontainer_create(devfd, cid);
-
-    for (i = 0; i < number_of_objects; i++)
-    {
-        mapped_data = (char *)mcontainer_alloc(devfd, i, max_size_of_objects);
-        if (strcmp(mapped_data, containers[cid][i]) != 0)
+            expected[(size_t)record->cid * number_of_objects + record->oid] = record->hash;
+        }
+        else if (record->op == TRACE_OP_DELETE)
         {
-            fprintf(stderr, "Container %d Object %d has a wrong value %s v.s. %s\n", cid, i, mapped_data, containers[cid][i]);
-            error++;
+            expected[(size_t)record->cid * number_of_objects + record->oid] = empty;
         }
+        if (!next_record(heap[0]))
+        {
+            fclose(heap[0]->fp);
+            heap[0] = heap[--count];
+        }
+        sift_down(heap, count, 0);
     }
 
-    // cleanup
-    if (error == 0)
+    // open the container kernel module to check the results.
+    devfd = open("/dev/mcontainer", O_RDWR);
+    if (devfd < 0)
     {
-        fprintf(stderr, "Container %d Pass\n", cid);
+        fprintf(stderr, "Device open failed");
+        exit(1);
     }
 
-    mcontainer_delete(devfd);
-    
-    close(devfd);
-    free(data);
+    // one child per container checks them all in parallel.
     for (i = 0; i < number_of_containers; i++)
     {
-        for (j = 0; j < number_of_objects; j++)
+        pid[i] = fork();
+        if (pid[i] == 0)
         {
-            free(containers[i][j]);
+            j = check_container(devfd, i, number_of_objects, max_size_of_objects, &expected[(size_t)i * number_of_objects]);
+            close(devfd);
+            exit(j ? 1 : 0);
         }
-        free(containers[i]);
     }
-    free(containers);
 
-    if (child_pid != 0)
+    for (i = 0; i < number_of_containers; i++)
     {
-        for (i = 0; i < (number_of_containers - 1); i++)
+        if (pid[i] < 0 || waitpid(pid[i], &stat, 0) < 0 || !WIFEXITED(stat) || WEXITSTATUS(stat) != 0)
         {
-            waitpid(pid[i], &stat, 0);  
+            failed++;
         }
     }
 
+    // cleanup
+    close(devfd);
+    free(expected);
+    free(cursors);
+    free(heap);
     free(pid);
-    return 0;
+    return failed ? 1 : 0;
 }
@@ -41,10 +41,208 @@ struct memory_container_cmd
     __u64 oid;
 };
 
+struct memory_container_checkpoint_cmd
+{
+    __u64 fd;
+    __u64 offset;
+    __u64 size;
+};
+
+#define MCONTAINER_ADVICE_NORMAL 0
+#define MCONTAINER_ADVICE_RANDOM 1
+#define MCONTAINER_ADVICE_SEQUENTIAL 2
+#define MCONTAINER_ADVICE_WILLNEED 3
+#define MCONTAINER_ADVICE_DONTNEED 4
+
+struct memory_container_advise_cmd
+{
+    __u64 oid;
+    __u64 offset;
+    __u64 length;
+    __u64 advice;
+};
+
+struct memory_container_lockset_cmd
+{
+    __u64 oids;
+    __u64 count;
+    __u64 timeout_ms;
+};
+
+struct memory_container_stats
+{
+    __u64 objects;
+    __u64 resident_bytes;
+    __u64 compressed_pages;
+    __u64 compressed_bytes;
+    __u64 decompressions;
+    __u64 decompress_ns;
+    __u64 pooled_pages;
+    __u64 working_set_bytes;
+};
+
+// Mapping an object at page offset (oid | MCONTAINER_HEADER_PAGE) gives one
+// shared page starting with this header instead of the object's contents.
+// Writers holding the object lock make version odd while they update the
+// object and even again when done, so readers can run without the lock and
+// retry when the version moved.
+#define MCONTAINER_HEADER_PAGE (1ULL << 40)
+
+struct memory_container_object_header
+{
+    __u64 version;
+};
+
+// digest is the CRC32C of the object's size bytes; status is 0 or a negative
+// errno for this entry alone.
+struct memory_container_digest
+{
+    __u64 oid;
+    __u64 size;
+    __u32 digest;
+    __s32 status;
+};
+
+struct memory_container_digest_cmd
+{
+    __u64 digests;
+    __u64 count;
+};
+
+// Moves length bytes between fd at file_offset and object oid at
+// object_offset; length is updated with the bytes actually moved.
+struct memory_container_transfer_cmd
+{
+    __u64 oid;
+    __u64 fd;
+    __u64 file_offset;
+    __u64 object_offset;
+    __u64 length;
+};
+
+// Object bytes are addressed on the device fd as (oid << 32) | offset, so
+// pread()/pwrite() and preadv()/pwritev() reach one object without mmap.
+// The position is a signed loff_t: only oids up to MCONTAINER_POS_OID_MAX
+// and offsets below 4 GiB can be reached this way.
+#define MCONTAINER_POS_SHIFT 32
+#define MCONTAINER_POS_MASK ((1ULL << MCONTAINER_POS_SHIFT) - 1)
+#define MCONTAINER_POS_OID_MAX (MCONTAINER_POS_MASK >> 1)
+#define MCONTAINER_POS(oid, offset) (((__u64)(oid) << MCONTAINER_POS_SHIFT) | ((offset) & MCONTAINER_POS_MASK))
+
+// One piece of a batched read or write; result is the bytes moved or a
+// negative errno for this piece alone.
+struct memory_container_io
+{
+    __u64 oid;
+    __u64 offset;
+    __u64 buf;
+    __u64 length;
+    __s64 result;
+};
+
+struct memory_container_io_cmd
+{
+    __u64 ios;
+    __u64 count;
+};
+
+// Creates or joins container cid like CREATE and keeps a pool of about pages
+// pre-zeroed pages for it, so first touches of its objects need no zeroing.
+struct memory_container_pool_cmd
+{
+    __u64 cid;
+    __u64 pages;
+};
+
+// Working-set estimation runs when the wss_interval module parameter is set.
+// touched_bytes counts the bytes used during the last complete window, out
+// of size bytes allocated and resident_bytes in memory now, and history[]
+// the bytes used in the windows before it, newest first. The command
+// fills objects[] for up to count objects, sets count to the number of
+// objects in the container and gives the container's totals.
+#define MCONTAINER_WSS_HISTORY 8
+
+struct memory_container_working_set
+{
+    __u64 oid;
+    __u64 size;
+    __u64 resident_bytes;
+    __u64 touched_bytes;
+    __u64 history[MCONTAINER_WSS_HISTORY];
+};
+
+struct memory_container_working_set_cmd
+{
+    __u64 objects;
+    __u64 count;
+    __u64 interval;
+    __u64 windows;
+    __u64 size;
+    __u64 resident_bytes;
+    __u64 touched_bytes;
+};
+
+// Every published change advances an object's generation. WAIT sleeps until
+// it differs from cmd.generation and returns the new one there.
+struct memory_container_wait_cmd
+{
+    __u64 oid;
+    __u64 generation;
+    __u64 timeout_ms;
+};
+
+// WATCH adds oid to the objects that make poll() on this fd readable, or
+// acknowledges the changes seen so far, and returns the current generation.
+#define MCONTAINER_WATCH_ADD 0
+#define MCONTAINER_WATCH_REMOVE 1
+
+struct memory_container_watch_cmd
+{
+    __u64 oid;
+    __u64 generation;
+    __u64 flags;
+};
+
+// On-disk checkpoint layout: one header, then for every object a record
+// followed by size bytes of contents.
+#define MCONTAINER_CHECKPOINT_MAGIC 0x54504b434e434dULL
+#define MCONTAINER_CHECKPOINT_VERSION 1
+
+struct memory_container_checkpoint_header
+{
+    __u64 magic;
+    __u64 version;
+    __u64 objects;
+};
+
+struct memory_container_checkpoint_object
+{
+    __u64 oid;
+    __u64 size;
+};
+
 #define MCONTAINER_IOCTL_DELETE _IOWR('N', 0x45, struct memory_container_cmd)
 #define MCONTAINER_IOCTL_CREATE _IOWR('N', 0x46, struct memory_container_cmd)
 #define MCONTAINER_IOCTL_LOCK _IOWR('N', 0x47, struct memory_container_cmd)
 #define MCONTAINER_IOCTL_UNLOCK _IOWR('N', 0x48, struct memory_container_cmd)
 #define MCONTAINER_IOCTL_FREE _IOWR('N', 0x49, struct memory_container_cmd)
+#define MCONTAINER_IOCTL_SNAPSHOT _IOWR('N', 0x4a, struct memory_container_cmd)
+#define MCONTAINER_IOCTL_CHECKPOINT _IOWR('N', 0x4b, struct memory_container_checkpoint_cmd)
+#define MCONTAINER_IOCTL_RESTORE _IOWR('N', 0x4c, struct memory_container_checkpoint_cmd)
+#define MCONTAINER_IOCTL_MARK_READONLY _IOWR('N', 0x4d, struct memory_container_cmd)
+#define MCONTAINER_IOCTL_STATS _IOR('N', 0x4e, struct memory_container_stats)
+#define MCONTAINER_IOCTL_ADVISE _IOWR('N', 0x4f, struct memory_container_advise_cmd)
+#define MCONTAINER_IOCTL_LOCK_SET _IOWR('N', 0x50, struct memory_container_lockset_cmd)
+#define MCONTAINER_IOCTL_UNLOCK_SET _IOWR('N', 0x51, struct memory_container_lockset_cmd)
+#define MCONTAINER_IOCTL_DIGEST _IOWR('N', 0x52, struct memory_container_digest_cmd)
+#define MCONTAINER_IOCTL_IMPORT _IOWR('N', 0x53, struct memory_container_transfer_cmd)
+#define MCONTAINER_IOCTL_EXPORT _IOWR('N', 0x54, struct memory_container_transfer_cmd)
+#define MCONTAINER_IOCTL_READ_BATCH _IOWR('N', 0x55, struct memory_container_io_cmd)
+#define MCONTAINER_IOCTL_WRITE_BATCH _IOWR('N', 0x56, struct memory_container_io_cmd)
+#define MCONTAINER_IOCTL_PUBLISH _IOWR('N', 0x57, struct memory_container_cmd)
+#define MCONTAINER_IOCTL_WAIT _IOWR('N', 0x58, struct memory_container_wait_cmd)
+#define MCONTAINER_IOCTL_WATCH _IOWR('N', 0x59, struct memory_container_watch_cmd)
+#define MCONTAINER_IOCTL_CREATE_POOLED _IOWR('N', 0x5a, struct memory_container_pool_cmd)
+#define MCONTAINER_IOCTL_WORKING_SET _IOWR('N', 0x5b, struct memory_container_working_set_cmd)
 
 #endif
@@ -47,6 +47,12 @@ extern long memory_container_lock(struct memory_container_cmd __user *user_cmd);
 extern long memory_container_unlock(struct memory_container_cmd __user *user_cmd);
 extern long memory_container_ioctl(struct file *filp, unsigned int cmd, unsigned long arg);
 extern int memory_container_mmap(struct file *filp, struct vm_area_struct *vma);
+extern ssize_t memory_container_read_iter(struct kiocb *iocb, struct iov_iter *to);
+extern ssize_t memory_container_write_iter(struct kiocb *iocb, struct iov_iter *from);
+extern unsigned int memory_container_poll(struct file *filp, poll_table *wait);
+extern int memory_container_flush(struct file *filp, fl_owner_t id);
+extern int memory_container_open(struct inode *inode, struct file *filp);
+extern int memory_container_release(struct inode *inode, struct file *filp);
 extern int memory_container_init(void);
 extern void memory_container_exit(void);
 
@@ -54,6 +60,13 @@ static const struct file_operations memory_container_fops = {
     .owner                = THIS_MODULE,
     .unlocked_ioctl       = memory_container_ioctl,
     .mmap                 = memory_container_mmap,
+    .read_iter            = memory_container_read_iter,
+    .write_iter           = memory_container_write_iter,
+    .llseek               = default_llseek,
+    .poll                 = memory_container_poll,
+    .open                 = memory_container_open,
+    .flush                = memory_container_flush,
+    .release              = memory_container_release,
 };
 
 struct miscdevice memory_container_dev = {
@@ -45,6 +45,15 @@
 #include <linux/sched.h>
 
 extern struct miscdevice memory_container_dev;
+extern void memory_container_reclaim_drain(void);
+extern void memory_container_compress_start(void);
+extern void memory_container_compress_stop(void);
+extern void memory_container_wss_start(void);
+extern void memory_container_wss_stop(void);
+extern int memory_container_pool_start(void);
+extern void memory_container_pool_stop(void);
+extern void memory_container_task_start(void);
+extern void memory_container_task_stop(void);
 
 
 int memory_container_init(void)
@@ -57,6 +66,17 @@ int memory_container_init(void)
         return ret;
     }
 
+    if ((ret = memory_container_pool_start()))
+    {
+        printk(KERN_ERR "Unable to register \"memory_container\" page pool shrinker\n");
+        misc_deregister(&memory_container_dev);
+        return ret;
+    }
+
+    memory_container_task_start();
+    memory_container_compress_start();
+    memory_container_wss_start();
+
     printk(KERN_ERR "\"memory_container\" misc device installed\n");
     printk(KERN_ERR "\"memory_container\" version 0.1\n");
     return ret;
@@ -66,4 +86,9 @@ int memory_container_init(void)
 void memory_container_exit(void)
 {
     misc_deregister(&memory_container_dev);
+    memory_container_task_stop();
+    memory_container_compress_stop();
+    memory_container_wss_stop();
+    memory_container_reclaim_drain();
+    memory_container_pool_stop();
 }
@@ -44,10 +44,26 @@
 #include <linux/mutex.h>
 #include <linux/sched.h>
 #include <linux/kthread.h>
+#include <linux/workqueue.h>
+#include <linux/spinlock.h>
+#include <linux/highmem.h>
+#include <linux/pagemap.h>
+#include <linux/vmalloc.h>
+#include <linux/file.h>
+#include <linux/hashtable.h>
+#include <linux/jhash.h>
+#include <linux/lz4.h>
+#include <linux/ktime.h>
+#include <linux/sort.h>
+#include <linux/crc32c.h>
+#include <linux/shrinker.h>
+#include <linux/profile.h>
 
+// process is referenced so an exited task is recognised by its flags.
 struct Node{
 	int pid;
 	struct task_struct *process;
+	struct file *filp;
 	struct Node* next;
 };
 
@@ -57,6 +73,9 @@ struct Container{
 	struct Container* next;
 	struct Node *head;
 	struct MemoryObject* memoryHead;
+	int readOnly;
+	struct file *pinnedBy;
+	struct PagePool* pool;
 };
 
 struct ContainerList{
@@ -66,14 +85,170 @@ struct ContainerList{
 struct MemoryObject{
 	unsigned long objectId;
 	struct MemoryObject* next;
-	struct mutex lockStatus;
-	unsigned long memoryStart;
+	int lockOwner;
+	int lockAbandoned;
+	int lockDetached;
+	spinlock_t lockGuard;
+	wait_queue_head_t lockQueue;
+	struct mutex pageLock;
+	int frozen;
+	unsigned long nrPages;
+	struct page **pages;
+	struct CompressedPage **zpages;
+	unsigned long zPages;
+	unsigned long zBytes;
+	unsigned long decompressions;
+	u64 decompressNs;
+	unsigned long lastAccess;
+	unsigned long zappedAt;
+	int advice;
+	unsigned long willStart;
+	unsigned long willEnd;
+	struct page *headerPage;
+	struct address_space *mapping;
+	int dirty;
+	atomic64_t generation;
+	atomic_t watchers;
+	struct PagePool* pool;
+	unsigned long *wssBits;
+	unsigned long wssPages;
+	unsigned int wssSample;
+	unsigned int wssPhase;
+	u64 wssTouched;
+	u64 wssHistory[MCONTAINER_WSS_HISTORY];
+	atomic_t mapCount;
+	atomic_t refCount;
+};
+
+struct CompressedPage{
+	size_t length;
+	unsigned char data[0];
 };
 
 struct ContainerList containerArray;
 
 static DEFINE_MUTEX(containerMutex);
 
+// Deleted containers are detached under containerMutex and parked here until
+// the reclaim worker has freed their tasks and objects. A pass frees at most
+// RECLAIM_BATCH pages, tasks and objects.
+#define RECLAIM_BATCH 1024
+
+static struct Container* reclaimHead = NULL;
+static DEFINE_SPINLOCK(reclaimLock);
+static void reclaimContainers(struct work_struct *work);
+static DECLARE_WORK(reclaimWork, reclaimContainers);
+
+// Object pages may be shared copy-on-write between a container and its
+// snapshots. page_private() of every object page counts the objects holding
+// it, and a page with more than one holder is copied before it is written.
+static DEFINE_SPINLOCK(pageShareLock);
+
+// Containers created with a capacity hint keep a pool of pre-zeroed pages
+// that first touches of their objects draw from, so the zeroing is done by
+// poolWork instead of on the fault path. A pool is shared by its container
+// and the objects created in it; the shrinker takes idle pooled pages back
+// under memory pressure and refilling then pauses for a second.
+#define POOL_MAX_PAGES 65536
+
+struct PagePool{
+	spinlock_t lock;
+	struct list_head pages;
+	unsigned long count;
+	unsigned long target;
+	atomic_t refCount;
+	struct list_head node;
+};
+
+static LIST_HEAD(poolList);
+static DEFINE_MUTEX(poolListMutex);
+static atomic_long_t pooledPages;
+static unsigned long poolPressure;
+static void refillPagePools(struct work_struct *work);
+static DECLARE_DELAYED_WORK(poolWork, refillPagePools);
+
+// Faults on an object frozen by an in-progress snapshot sleep here.
+static DECLARE_WAIT_QUEUE_HEAD(snapshotWait);
+
+// Waiters for object changes, both WAIT and poll(), sleep here. It is one
+// queue for all objects so a poll() entry never outlives its object.
+static DECLARE_WAIT_QUEUE_HEAD(changeWait);
+
+// The objects a device fd watches for poll(), kept in filp->private_data.
+struct Watch{
+	struct MemoryObject* obj;
+	u64 generation;
+	struct Watch* next;
+};
+
+struct WatchSet{
+	struct mutex lock;
+	struct Watch* head;
+};
+
+// Pages of objects marked read-only are published in dedupTable, keyed by a
+// hash of their contents, so identical pages of any container are merged.
+// A published page carries PAGE_DEDUP in page_private() and is never written
+// in place again.
+#define PAGE_DEDUP (1UL << (BITS_PER_LONG - 1))
+#define DEDUP_HASH_BITS 12
+
+struct DedupPage{
+	u32 hash;
+	struct page *page;
+	struct hlist_node node;
+};
+
+static DEFINE_HASHTABLE(dedupTable, DEDUP_HASH_BITS);
+static DEFINE_MUTEX(dedupMutex);
+
+// Objects that have not been faulted or locked for compress_interval seconds
+// get their private pages LZ4 compressed by compressWork. Loads and stores
+// through an existing mapping are not seen, so a mapped object is zapped
+// first and compressed a pass later if nothing faulted it back in.
+static unsigned int compress_interval = 0;
+static int setCompressInterval(const char *val, const struct kernel_param *kp);
+static const struct kernel_param_ops compressIntervalOps = {
+	.set = setCompressInterval,
+	.get = param_get_uint,
+};
+module_param_cb(compress_interval, &compressIntervalOps, &compress_interval, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(compress_interval, "seconds before an idle object is compressed, 0 disables");
+
+static void compressColdObjects(struct work_struct *work);
+static DECLARE_DELAYED_WORK(compressWork, compressColdObjects);
+static int compressStarted = 0;
+
+// Every wss_interval seconds wssWork closes a working-set window: of every
+// object it counts the sampled pages used since the last one, then unmaps
+// the sample again so the next use of each of them faults and is seen.
+// Each object keeps the last MCONTAINER_WSS_HISTORY windows.
+static unsigned int wss_interval = 0;
+static int setWssInterval(const char *val, const struct kernel_param *kp);
+static const struct kernel_param_ops wssIntervalOps = {
+	.set = setWssInterval,
+	.get = param_get_uint,
+};
+module_param_cb(wss_interval, &wssIntervalOps, &wss_interval, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(wss_interval, "seconds in a working-set window, 0 disables");
+// One page in wss_sample is sampled, the one picked shifts every window.
+// Every window zaps the sampled pages that are resident, ring objects
+// included, so each of them faults once more per window; 1 samples every
+// page for an exact count at the price of a fault on every page in use.
+static unsigned int wss_sample = 16;
+module_param(wss_sample, uint, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(wss_sample, "track one page in this many for working-set estimation, 1 faults every page in use once each window");
+
+static unsigned long wssWindows = 0;
+static void scanWorkingSets(struct work_struct *work);
+static DECLARE_DELAYED_WORK(wssWork, scanWorkingSets);
+static int wssStarted = 0;
+
+// Pages mapped past a faulting page inside a WILLNEED range, or of an
+// object advised SEQUENTIAL.
+#define MAP_AHEAD_WILLNEED 64
+#define MAP_AHEAD_SEQUENTIAL 16
+
 struct Container* checkIfContainerExist(u64 cid){
 	struct Container *iterator = containerArray.head;
 	//printk("Check Container start\n");
@@ -88,17 +263,24 @@ struct Container* checkIfContainerExist(u64 cid){
 	return(NULL);
 }
 
-struct Node* createNode(int pid, struct task_struct *processStruct){
+struct Node* createNode(int pid, struct task_struct *processStruct, struct file *filp){
 	//printk("inside custom create node function\n");
 	struct Node *taskToAdd;
 	taskToAdd = kmalloc(sizeof(struct Node), GFP_KERNEL);
 	taskToAdd->pid = pid;
 	taskToAdd->process = processStruct;
+	get_task_struct(processStruct);
+	taskToAdd->filp = filp;
 	taskToAdd->next = NULL;
 	//printk("before return of custom create node function\n");
 	return(taskToAdd);
 }
 
+void freeNode(struct Node* node){
+	put_task_struct(node->process);
+	kfree((void *)node);
+}
+
 int addNodeToContainer(struct Container* containerToAdd, struct Node* nextTask){
 	//printk("inside custom add node to container function\n");
 	struct Node* iterator = containerToAdd->head;
@@ -126,6 +308,9 @@ struct Container* createContainer(u64 cid){
 	newContainer->head = NULL;
 	newContainer->lockStatus = 0;
 	newContainer->memoryHead = NULL;
+	newContainer->readOnly = 0;
+	newContainer->pinnedBy = NULL;
+	newContainer->pool = NULL;
 	//printk("before return of custom method create container\n");
 	return(newContainer);
 }
@@ -162,30 +347,38 @@ int deleteTaskFromContainer(int pid, struct Container* containsTask){
 		//printk("inside else of custom delete task from container\n");
 		previous->next = iterator->next;
 	}
-	kfree((void *)iterator);
+	freeNode(iterator);
 	//printk("before return to custom delete task from container\n");
 	return(1);
 }
 
-int deleteContainer(u64 cid){
+void queueContainerReclaim(struct Container* container){
+	spin_lock(&reclaimLock);
+	container->next = reclaimHead;
+	reclaimHead = container;
+	spin_unlock(&reclaimLock);
+	schedule_work(&reclaimWork);
+}
+
+int deleteContainer(struct Container* container){
 	//printk("inside custom delete container\n");
 	struct Container* iterator = containerArray.head;
 	struct Container* previous = NULL;
-	while(iterator != NULL && iterator->cid != cid){
+	while(iterator != NULL && iterator != container){
 		previous = iterator;
 		iterator = iterator->next;
 	}
-	if(previous == NULL && iterator->cid == cid){
-		//printk("inside if of custom delete container\n");
+	if(iterator == NULL){
+		return(0);
+	}
+	if(previous == NULL){
 		containerArray.head = iterator->next;
-	}else if(iterator != NULL && iterator->cid == cid){
-		//printk("inside else of custom delete container\n");
-		previous->next = iterator->next;
 	}else{
-		previous->next = NULL;
+		previous->next = iterator->next;
 	}
-	kfree((void *)iterator);
+	queueContainerReclaim(iterator);
 	//printk("before return of custom delete container\n");
+	return(1);
 }
 
 int checkIfEmptyContainer(struct Container* emptyContainer){
@@ -239,177 +432,3100 @@ struct MemoryObject* createMemoryObject(unsigned long objectId){
 	struct MemoryObject* obj = kmalloc(sizeof(struct MemoryObject), GFP_KERNEL);
 	obj->objectId = objectId;
 	obj->next = NULL;
-	//obj->lockStatus = 0;
-	mutex_init(&obj->lockStatus);
-	obj->memoryStart = NULL;
+	obj->lockOwner = 0;
+	obj->lockAbandoned = 0;
+	obj->lockDetached = 0;
+	spin_lock_init(&obj->lockGuard);
+	init_waitqueue_head(&obj->lockQueue);
+	mutex_init(&obj->pageLock);
+	obj->frozen = 0;
+	obj->nrPages = 0;
+	obj->pages = NULL;
+	obj->zpages = NULL;
+	obj->zPages = 0;
+	obj->zBytes = 0;
+	obj->decompressions = 0;
+	obj->decompressNs = 0;
+	obj->lastAccess = jiffies;
+	obj->zappedAt = 0;
+	obj->advice = MCONTAINER_ADVICE_NORMAL;
+	obj->willStart = 0;
+	obj->willEnd = 0;
+	obj->headerPage = NULL;
+	obj->mapping = NULL;
+	obj->dirty = 0;
+	atomic64_set(&obj->generation, 0);
+	atomic_set(&obj->watchers, 0);
+	obj->pool = NULL;
+	obj->wssBits = NULL;
+	obj->wssPages = 0;
+	obj->wssSample = 1;
+	obj->wssPhase = 0;
+	obj->wssTouched = 0;
+	memset(obj->wssHistory, 0, sizeof(obj->wssHistory));
+	atomic_set(&obj->mapCount, 0);
+	atomic_set(&obj->refCount, 1);
 	//printk("before return of custom create memory object function\n");
 	return(obj);
 }
 
-int removeObject(struct Container* container, unsigned long oid){
-	//printk("inside custom remove object function\n");
-	struct MemoryObject* iterator = container->memoryHead;
-	struct MemoryObject* previous = NULL;
-	while(iterator!=NULL){
-		if(iterator->objectId == oid){
-			//printk("inside if of custom remove object function\n");
-			break;
-		}
-		previous = iterator;
-		iterator = iterator->next;
+// Object locks are owned by a pid rather than being a struct mutex so that
+// they can be handed back when the owner goes away without unlocking.
+// Returns 1 when taken, 2 when taken from an abandoned owner, -1 when the
+// object was freed in the meantime and 0 when it is still held.
+int tryLockMemoryObject(struct MemoryObject* obj){
+	int ret = 0;
+	spin_lock(&obj->lockGuard);
+	if(obj->lockDetached){
+		ret = -1;
+	}else if(obj->lockOwner == 0){
+		obj->lockOwner = current->pid;
+		ret = obj->lockAbandoned ? 2 : 1;
+		obj->lockAbandoned = 0;
 	}
-	if(previous==NULL && iterator->objectId == oid){
-		//printk("inside second if of custom remove object function\n");
-		container->memoryHead = iterator->next;
-	}else{
-		//printk("inside third if of custom remove object function\n");
-		previous->next = iterator->next;
+	spin_unlock(&obj->lockGuard);
+	return(ret);
+}
+
+// Waits up to *timeout jiffies for the lock and leaves what is left of the
+// wait in *timeout, so several locks can share one deadline.
+int lockMemoryObjectTimeout(struct MemoryObject* obj, long *timeout){
+	int state;
+	long ret = wait_event_interruptible_timeout(obj->lockQueue, (state = tryLockMemoryObject(obj)) != 0, *timeout);
+	if(ret < 0){
+		return(ret);
 	}
-	kfree((void *)iterator);
-	//printk("before return of custom remove object function\n");
-	return(NULL);
+	if(ret == 0){
+		return(-ETIMEDOUT);
+	}
+	*timeout = ret;
+	if(state < 0){
+		return(-EAGAIN);
+	}
+	return(state == 2 ? -EOWNERDEAD : 0);
 }
 
-int addMemoryToContainer(struct Container* container, struct MemoryObject* memory){
-	//printk("inside custom add memory to container function\n");
-	
+int lockMemoryObject(struct MemoryObject* obj){
+	long timeout = MAX_SCHEDULE_TIMEOUT;
+	return(lockMemoryObjectTimeout(obj, &timeout));
+}
+
+// Publishing a change advances obj->generation and wakes its watchers.
+// Most changes have nobody waiting, so the shared queue's lock is only
+// taken when someone is on it. The barrier pairs with the one waiters issue
+// between queueing and reading the generation, so either the waiter sees
+// the new generation or it is seen on the queue.
+void publishObjectChange(struct MemoryObject* obj){
+	atomic64_inc(&obj->generation);
+	smp_mb__after_atomic();
+	if(waitqueue_active(&changeWait)){
+		wake_up_all(&changeWait);
+	}
+}
+
+// Mapped writers only enter the kernel on the first write through a pte, so
+// while anyone watches obj its mappings are zapped to catch the next write.
+void armObjectWatch(struct MemoryObject* obj){
+	struct address_space *mapping = READ_ONCE(obj->mapping);
+	if(mapping != NULL && atomic_read(&obj->watchers) > 0){
+		unmapObjectPages(mapping, obj, 0, READ_ONCE(obj->nrPages));
+	}
+}
+
+// Writes made under the object lock are published when it is released, so
+// watchers never see a half-done update; other writes are published now.
+void noteObjectWrite(struct MemoryObject* obj){
+	int locked;
+	spin_lock(&obj->lockGuard);
+	locked = obj->lockOwner != 0;
+	if(locked){
+		obj->dirty = 1;
+	}
+	spin_unlock(&obj->lockGuard);
+	if(!locked){
+		publishObjectChange(obj);
+	}
+}
+
+// Pages in the working-set sample that have not been used yet this window.
+// Called with obj->pageLock held.
+int workingSetPending(struct MemoryObject* obj, unsigned long index){
+	return(obj->wssBits != NULL && index < obj->wssPages && index % obj->wssSample == obj->wssPhase && !test_bit(index, obj->wssBits));
+}
+
+// Counts page index of obj as used in the current working-set window.
+// Called with obj->pageLock held.
+void noteObjectAccess(struct MemoryObject* obj, unsigned long index){
+	if(workingSetPending(obj, index)){
+		__set_bit(index, obj->wssBits);
+	}
+}
+
+int unlockMemoryObject(struct MemoryObject* obj, int pid){
+	int ret = -EPERM;
+	int dirty = 0;
+	spin_lock(&obj->lockGuard);
+	if(obj->lockOwner == pid){
+		obj->lockOwner = 0;
+		dirty = obj->dirty;
+		obj->dirty = 0;
+		ret = 0;
+	}
+	spin_unlock(&obj->lockGuard);
+	if(ret == 0){
+		wake_up(&obj->lockQueue);
+	}
+	if(dirty){
+		publishObjectChange(obj);
+		armObjectWatch(obj);
+	}
+	return(ret);
+}
+
+// Hands back a lock taken by a lock set that could not take all of its
+// locks. Nothing was written under it, so there is no change to publish,
+// and a lock taken from an abandoned owner stays marked abandoned for
+// whoever takes it next.
+void rollbackMemoryObjectLock(struct MemoryObject* obj, int abandoned){
+	spin_lock(&obj->lockGuard);
+	if(obj->lockOwner == current->pid){
+		obj->lockOwner = 0;
+		obj->lockAbandoned = abandoned;
+	}
+	spin_unlock(&obj->lockGuard);
+	wake_up(&obj->lockQueue);
+}
+
+// Wakes anyone waiting for the lock of an object that is leaving its
+// container so they look it up again instead of sleeping forever.
+void detachMemoryObject(struct MemoryObject* obj){
+	spin_lock(&obj->lockGuard);
+	obj->lockDetached = 1;
+	spin_unlock(&obj->lockGuard);
+	wake_up_all(&obj->lockQueue);
+}
+
+// Releases the locks a departing task still holds and marks them abandoned,
+// so the next owner gets -EOWNERDEAD and knows the object may be half updated.
+// A holder that died between mcontainer_write_begin() and _end() leaves the
+// version odd and optimistic readers would spin on it for ever. Nobody else
+// can be writing while the lock is still owned by the dead pid, so bumping it
+// back to even is safe; readers still retry since it changed.
+void repairObjectVersion(struct MemoryObject* obj){
+	struct memory_container_object_header *header;
+	if(obj->headerPage == NULL){
+		return;
+	}
+	header = page_address(obj->headerPage);
+	if(READ_ONCE(header->version) & 1){
+		smp_wmb();
+		WRITE_ONCE(header->version, header->version + 1);
+	}
+}
+
+void abandonObjectLocks(struct Container* container, int pid){
 	struct MemoryObject* iterator = container->memoryHead;
-	struct MemoryObject* previous = NULL;
 	while(iterator != NULL){
-		previous = iterator;
+		int released = 0, dirty = 0;
+		spin_lock(&iterator->lockGuard);
+		if(iterator->lockOwner == pid){
+			iterator->lockOwner = 0;
+			iterator->lockAbandoned = 1;
+			repairObjectVersion(iterator);
+			dirty = iterator->dirty;
+			iterator->dirty = 0;
+			released = 1;
+		}
+		spin_unlock(&iterator->lockGuard);
+		if(released){
+			wake_up(&iterator->lockQueue);
+		}
+		if(dirty){
+			publishObjectChange(iterator);
+		}
 		iterator = iterator->next;
 	}
-	if(previous == NULL){
-		container->memoryHead = memory;
-	}else{
-		previous->next = memory;
+}
+
+// Drops every task that joined through filp, or with filp NULL the nodes of
+// task, or with both NULL those of tasks that are exiting, and deletes the
+// containers this leaves empty.
+void removeTasks(struct file *filp, struct task_struct *task){
+	struct Container* container = containerArray.head;
+	while(container != NULL){
+		struct Container* nextContainer = container->next;
+		struct Node* iterator = container->head;
+		struct Node* previous = NULL;
+		int removed = 0;
+		while(iterator != NULL){
+			struct Node* nextNode = iterator->next;
+			int match;
+			if(filp != NULL){
+				match = iterator->filp == filp;
+			}else if(task != NULL){
+				match = iterator->process == task;
+			}else{
+				match = (iterator->process->flags & PF_EXITING) != 0;
+			}
+			if(match){
+				if(previous == NULL){
+					container->head = nextNode;
+				}else{
+					previous->next = nextNode;
+				}
+				abandonObjectLocks(container, iterator->pid);
+				freeNode(iterator);
+				removed++;
+			}else{
+				previous = iterator;
+			}
+			iterator = nextNode;
+		}
+		if(removed && checkIfEmptyContainer(container) == 1){
+			deleteContainer(container);
+		}else if(filp != NULL && container->pinnedBy == filp){
+			// nobody joined the snapshot before its creator closed the device
+			deleteContainer(container);
+		}
+		container = nextContainer;
 	}
-	//printk("before return of custom add memory to container\n");
-	return(1);
 }
 
-int memory_container_mmap(struct file *filp, struct vm_area_struct *vma)
-{
-	//printk("inside default memory container mmap\n");
-	mutex_lock(&containerMutex);
-	//struct vm_area_struct* vmArea = kmalloc(sizeof(struct vm_area_struct),GFP_KERNEL);
-	//long cd = copy_from_user(vmArea, vma, sizeof(struct vm_area_struct));
-	//struct file* userFile = kmalloc(sizeof(struct file),GFP_KERNEL);
-	//long ab = copy_from_user(userFile, filp, sizeof(struct file));
-	//char* startAddress = kmalloc(vm_end-vm_start, GFP_KERNEL);
-	//struct MemoryObject obj;
-	unsigned long sizeNo = vma->vm_end - vma->vm_start;
-	unsigned long objSize = sizeNo*sizeof(char);
-	unsigned long objectId = vma->vm_pgoff;
-	struct Container* currentContainer = getContainerOfTask(current->pid);
-	struct MemoryObject* objToCheck = getContainerMemoryObject(currentContainer, objectId);
-	if(objToCheck == NULL){
-		objToCheck = createMemoryObject(objectId);
-		addMemoryToContainer(currentContainer, objToCheck);
+struct page* allocObjectPage(void){
+	struct page *page = alloc_page(GFP_HIGHUSER | __GFP_ZERO);
+	if(page != NULL){
+		set_page_private(page, 1);
 	}
-	if(objToCheck->memoryStart == NULL){
-		//printk("inside if of default memory container mmap\n");
-		objToCheck->memoryStart = kcalloc(sizeNo,sizeof(char), GFP_KERNEL);	
+	return(page);
+}
+
+struct PagePool* createPagePool(unsigned long target){
+	struct PagePool* pool = kmalloc(sizeof(struct PagePool), GFP_KERNEL);
+	if(pool == NULL){
+		return(NULL);
 	}
-	//struct MemoryObject* obj = createMemoryObject(objSize, objectId);
-	//addMemoryToContainer(currentContainer, obj);
-	mutex_unlock(&containerMutex);
-	unsigned long pfn = virt_to_phys((void *)objToCheck->memoryStart)>>PAGE_SHIFT;
-	remap_pfn_range(vma, vma->vm_start, pfn, vma->vm_end-vma->vm_start,vma->vm_page_prot);
-	//printk("before return of default memory container mmap\n");
-    	return 0;
+	spin_lock_init(&pool->lock);
+	INIT_LIST_HEAD(&pool->pages);
+	pool->count = 0;
+	pool->target = target;
+	atomic_set(&pool->refCount, 1);
+	mutex_lock(&poolListMutex);
+	list_add_tail(&pool->node, &poolList);
+	mutex_unlock(&poolListMutex);
+	return(pool);
 }
 
+// Pops a pooled page, or returns NULL when the pool is empty.
+struct page* takePooledPage(struct PagePool* pool){
+	struct page *page = NULL;
+	spin_lock(&pool->lock);
+	if(!list_empty(&pool->pages)){
+		page = list_first_entry(&pool->pages, struct page, lru);
+		list_del(&page->lru);
+		pool->count--;
+	}
+	spin_unlock(&pool->lock);
+	if(page != NULL){
+		atomic_long_dec(&pooledPages);
+	}
+	return(page);
+}
 
-int memory_container_lock(struct memory_container_cmd __user *user_cmd)
-{
-	//printk("Inside container lock");
-	struct memory_container_cmd* mcontainer = kmalloc(sizeof(struct memory_container_cmd), GFP_KERNEL);
-	long cd = copy_from_user(mcontainer, user_cmd, sizeof(struct memory_container_cmd));
-	struct Container* containerMemory = getContainerOfTask(current->pid);
-	struct MemoryObject* memObj = getContainerMemoryObject(containerMemory, mcontainer->oid);
-	if(memObj == NULL){
-		//printk("inside if of default container lock\n");
-		memObj = createMemoryObject(mcontainer->oid);
-		addMemoryToContainer(containerMemory, memObj);
-	}
-	/*while(memObj->lockStatus==1){
-		
-	}
-	memObj->lockStatus=1;*/
-	mutex_lock(&memObj->lockStatus);
-	//printk("before return of default container lock\n");
-	return 0;
+void putPagePool(struct PagePool* pool){
+	struct page *page;
+	if(pool == NULL || !atomic_dec_and_test(&pool->refCount)){
+		return;
+	}
+	mutex_lock(&poolListMutex);
+	list_del(&pool->node);
+	mutex_unlock(&poolListMutex);
+	while((page = takePooledPage(pool)) != NULL){
+		__free_page(page);
+	}
+	kfree((void *)pool);
 }
 
+// First touch of an object page: take a pre-zeroed page from the pool of
+// the object's container when there is one, and wake the refill worker
+// once the pool is down to half its target.
+struct page* newObjectPage(struct MemoryObject* obj){
+	struct PagePool* pool = obj->pool;
+	struct page *page;
+	if(pool == NULL){
+		return(allocObjectPage());
+	}
+	page = takePooledPage(pool);
+	if(READ_ONCE(pool->count) < READ_ONCE(pool->target) / 2){
+		schedule_delayed_work(&poolWork, 0);
+	}
+	if(page == NULL){
+		return(allocObjectPage());
+	}
+	set_page_private(page, 1);
+	return(page);
+}
 
-int memory_container_unlock(struct memory_container_cmd __user *user_cmd)
-{
-	//printk("inside container unlock");
-	struct memory_container_cmd* mcontainer = kmalloc(sizeof(struct memory_container_cmd), GFP_KERNEL);
-	long cd = copy_from_user(mcontainer, user_cmd, sizeof(struct memory_container_cmd));
-	struct Container* memoryContainer = getContainerOfTask(current->pid);
-	struct MemoryObject* memObj = getContainerMemoryObject(memoryContainer, mcontainer->oid);
-	if(memObj!=NULL){
-		//memObj->lockStatus = 0;
-		mutex_unlock(&memObj->lockStatus);
+static void refillPagePools(struct work_struct *work){
+	struct PagePool* pool;
+	unsigned long resume = READ_ONCE(poolPressure) + HZ;
+	if(time_before(jiffies, resume)){
+		// come back once the pause is over, nobody else may ask again
+		schedule_delayed_work(&poolWork, resume - jiffies);
+		return;
 	}
-	//printk("before return of container unlock\n");
-	return 0;
+	mutex_lock(&poolListMutex);
+	list_for_each_entry(pool, &poolList, node){
+		while(READ_ONCE(pool->count) < READ_ONCE(pool->target)){
+			struct page *page = alloc_page(GFP_HIGHUSER | __GFP_ZERO | __GFP_NOWARN | __GFP_NORETRY);
+			if(page == NULL){
+				schedule_delayed_work(&poolWork, HZ);
+				goto out;
+			}
+			spin_lock(&pool->lock);
+			list_add(&page->lru, &pool->pages);
+			pool->count++;
+			spin_unlock(&pool->lock);
+			atomic_long_inc(&pooledPages);
+			cond_resched();
+		}
+	}
+out:
+	mutex_unlock(&poolListMutex);
 }
 
+static unsigned long countPooledPages(struct shrinker *shrinker, struct shrink_control *sc){
+	return(atomic_long_read(&pooledPages));
+}
 
-int memory_container_delete(struct memory_container_cmd __user *user_cmd)
-{
-	//printk("inside container delete");
-	mutex_lock(&containerMutex);
-	struct memory_container_cmd* mcontainer;
-	mcontainer = kmalloc(sizeof(struct memory_container_cmd), GFP_KERNEL);
-	long val = copy_from_user(mcontainer, user_cmd, sizeof(struct memory_container_cmd));
-	struct Container* containerOfTask = getContainerOfTask(current->pid);
-	int n = deleteTaskFromContainer(current->pid, containerOfTask);
-	if(checkIfEmptyContainer(containerOfTask) == 1){
-		//printk("inside if of container delete\n");
-		deleteContainer(mcontainer->cid);
+static unsigned long scanPooledPages(struct shrinker *shrinker, struct shrink_control *sc){
+	struct PagePool* pool;
+	unsigned long freed = 0;
+	// the refill worker allocates with the list held, never wait for it
+	if(!mutex_trylock(&poolListMutex)){
+		return(SHRINK_STOP);
 	}
-	mutex_unlock(&containerMutex);
-	//printk("before return of container delete\n");
-	return 0;
+	WRITE_ONCE(poolPressure, jiffies);
+	list_for_each_entry(pool, &poolList, node){
+		struct page *page;
+		while(freed < sc->nr_to_scan && (page = takePooledPage(pool)) != NULL){
+			__free_page(page);
+			freed++;
+		}
+	}
+	mutex_unlock(&poolListMutex);
+	return(freed);
 }
 
+static struct shrinker poolShrinker = {
+	.count_objects = countPooledPages,
+	.scan_objects = scanPooledPages,
+	.seeks = DEFAULT_SEEKS,
+};
 
-int memory_container_create(struct memory_container_cmd __user *user_cmd)
-{
-	//printk("Inside container create");
-	mutex_lock(&containerMutex);
-	struct memory_container_cmd* mcontainer;
-	mcontainer = kmalloc(sizeof(struct memory_container_cmd),GFP_KERNEL);
-	long val = copy_from_user(mcontainer, user_cmd, sizeof(struct memory_container_cmd));
-	struct Container* containerExist = checkIfContainerExist(mcontainer->cid);
-	if(containerExist == NULL){
-		//printk("inside if of default container create\n");
-		containerExist = createContainer(mcontainer->cid);
-		addContainerToList(containerExist);
+int memory_container_pool_start(void){
+	return(register_shrinker(&poolShrinker));
+}
+
+void memory_container_pool_stop(void){
+	unregister_shrinker(&poolShrinker);
+	cancel_delayed_work_sync(&poolWork);
+}
+
+// Takes an exiting thread out of its containers even while its process
+// keeps the device open. Without CONFIG_PROFILING there is no hook and
+// exited tasks are only pruned on the next close or join.
+static int taskExitNotify(struct notifier_block *nb, unsigned long event, void *data){
+	// every task in the system exits through here
+	if(READ_ONCE(containerArray.head) == NULL){
+		return(NOTIFY_OK);
 	}
-	struct Node* newNode = createNode(current->pid, current);
-	addNodeToContainer(containerExist, newNode);
+	mutex_lock(&containerMutex);
+	removeTasks(NULL, (struct task_struct *)data);
 	mutex_unlock(&containerMutex);
-	//printk("before return of default container create\n");
-    	return 0;
+	return(NOTIFY_OK);
 }
 
+static struct notifier_block taskExitNotifier = {
+	.notifier_call = taskExitNotify,
+};
+static int taskExitRegistered = 0;
 
-int memory_container_free(struct memory_container_cmd __user *user_cmd)
-{
-	//printk("inside container free");
+void memory_container_task_start(void){
+	taskExitRegistered = profile_event_register(PROFILE_TASK_EXIT, &taskExitNotifier) == 0;
+}
+
+void memory_container_task_stop(void){
+	if(taskExitRegistered){
+		profile_event_unregister(PROFILE_TASK_EXIT, &taskExitNotifier);
+	}
+}
+
+void shareObjectPage(struct page *page){
+	spin_lock(&pageShareLock);
+	set_page_private(page, page_private(page) + 1);
+	spin_unlock(&pageShareLock);
+	get_page(page);
+}
+
+u32 hashPageContents(struct page *page){
+	u32 hash = jhash2((const u32 *)kmap(page), PAGE_SIZE / sizeof(u32), 0);
+	kunmap(page);
+	return(hash);
+}
+
+// Drops a published page from dedupTable once no object holds it anymore.
+void forgetDedupPage(struct page *page){
+	struct DedupPage* entry;
+	u32 hash = hashPageContents(page);
+	mutex_lock(&dedupMutex);
+	hash_for_each_possible(dedupTable, entry, node, hash){
+		if(entry->page != page){
+			continue;
+		}
+		spin_lock(&pageShareLock);
+		if(page_private(page) != PAGE_DEDUP){
+			// merged again while we were looking
+			spin_unlock(&pageShareLock);
+			break;
+		}
+		set_page_private(page, 0);
+		spin_unlock(&pageShareLock);
+		hash_del(&entry->node);
+		put_page(entry->page);
+		kfree((void *)entry);
+		break;
+	}
+	mutex_unlock(&dedupMutex);
+}
+
+void releaseObjectPage(struct page *page){
+	unsigned long holders;
+	spin_lock(&pageShareLock);
+	holders = page_private(page) - 1;
+	set_page_private(page, holders);
+	spin_unlock(&pageShareLock);
+	if(holders == PAGE_DEDUP){
+		forgetDedupPage(page);
+	}
+	put_page(page);
+}
+
+int objectPageShared(struct page *page){
+	unsigned long holders = READ_ONCE(page->private);
+	return((holders & PAGE_DEDUP) || holders > 1);
+}
+
+// Replaces page index of obj with an identical published page, or publishes
+// it if there is none. Called with obj->pageLock held.
+int dedupObjectPage(struct MemoryObject* obj, unsigned long index){
+	struct page *page = obj->pages[index];
+	struct DedupPage* entry;
+	void *addr;
+	u32 hash;
+	int merged = 0;
+	if(page == NULL || (page_private(page) & PAGE_DEDUP)){
+		return(0);
+	}
+	addr = kmap(page);
+	hash = jhash2((const u32 *)addr, PAGE_SIZE / sizeof(u32), 0);
+	mutex_lock(&dedupMutex);
+	hash_for_each_possible(dedupTable, entry, node, hash){
+		int identical;
+		if(entry->hash != hash){
+			continue;
+		}
+		identical = memcmp(kmap(entry->page), addr, PAGE_SIZE) == 0;
+		kunmap(entry->page);
+		if(!identical){
+			continue;
+		}
+		spin_lock(&pageShareLock);
+		// a page whose last holder is on its way out cannot be revived
+		if(page_private(entry->page) != PAGE_DEDUP){
+			set_page_private(entry->page, page_private(entry->page) + 1);
+			merged = 1;
+		}
+		spin_unlock(&pageShareLock);
+		if(merged){
+			get_page(entry->page);
+			obj->pages[index] = entry->page;
+			break;
+		}
+	}
+	if(!merged){
+		entry = kmalloc(sizeof(struct DedupPage), GFP_KERNEL);
+		if(entry != NULL){
+			entry->hash = hash;
+			entry->page = page;
+			get_page(page);
+			spin_lock(&pageShareLock);
+			set_page_private(page, page_private(page) | PAGE_DEDUP);
+			spin_unlock(&pageShareLock);
+			hash_add(dedupTable, &entry->node, hash);
+		}
+	}
+	mutex_unlock(&dedupMutex);
+	kunmap(page);
+	if(merged){
+		releaseObjectPage(page);
+	}
+	return(merged);
+}
+
+// Takes obj->pageLock once no snapshot is freezing the object.
+void lockObjectPages(struct MemoryObject* obj){
+	mutex_lock(&obj->pageLock);
+	while(obj->frozen){
+		mutex_unlock(&obj->pageLock);
+		wait_event(snapshotWait, READ_ONCE(obj->frozen) == 0);
+		mutex_lock(&obj->pageLock);
+	}
+}
+
+// Grows the page vector of an object to nrPages. Pages themselves are only
+// allocated when first faulted in. Called with obj->pageLock held.
+int resizeObjectPages(struct MemoryObject* obj, unsigned long nrPages){
+	struct page **pages;
+	struct CompressedPage **zpages = NULL;
+	if(nrPages <= obj->nrPages){
+		return(0);
+	}
+	pages = kcalloc(nrPages, sizeof(struct page *), GFP_KERNEL);
+	if(pages == NULL){
+		return(-ENOMEM);
+	}
+	if(obj->zpages != NULL){
+		zpages = kcalloc(nrPages, sizeof(struct CompressedPage *), GFP_KERNEL);
+		if(zpages == NULL){
+			kfree((void *)pages);
+			return(-ENOMEM);
+		}
+		memcpy(zpages, obj->zpages, obj->nrPages * sizeof(struct CompressedPage *));
+		kfree((void *)obj->zpages);
+		obj->zpages = zpages;
+	}
+	if(obj->pages != NULL){
+		memcpy(pages, obj->pages, obj->nrPages * sizeof(struct page *));
+		kfree((void *)obj->pages);
+	}
+	obj->pages = pages;
+	obj->nrPages = nrPages;
+	return(0);
+}
+
+void dropCompressedPage(struct MemoryObject* obj, unsigned long index){
+	if(obj->zpages != NULL && obj->zpages[index] != NULL){
+		obj->zPages--;
+		obj->zBytes -= obj->zpages[index]->length;
+		kfree((void *)obj->zpages[index]);
+		obj->zpages[index] = NULL;
+	}
+}
+
+// Makes a compressed page resident again so obj->pages[index] is
+// authoritative. Called with obj->pageLock held.
+int loadObjectPage(struct MemoryObject* obj, unsigned long index){
+	struct CompressedPage* zpage;
+	struct page *page;
+	size_t length;
+	u64 start;
+	int ret;
+	if(obj->zpages == NULL || obj->zpages[index] == NULL){
+		return(0);
+	}
+	zpage = obj->zpages[index];
+	page = allocObjectPage();
+	if(page == NULL){
+		return(-ENOMEM);
+	}
+	start = ktime_get_ns();
+	length = zpage->length;
+	ret = lz4_decompress(zpage->data, &length, kmap(page), PAGE_SIZE);
+	kunmap(page);
+	if(ret){
+		releaseObjectPage(page);
+		return(-EIO);
+	}
+	obj->decompressNs += ktime_get_ns() - start;
+	obj->decompressions++;
+	obj->pages[index] = page;
+	dropCompressedPage(obj, index);
+	return(0);
+}
+
+// Zaps user mappings of pages [index, index + count) of obj. Mappings are
+// keyed by oid in the device's address space, so overlapping objects of other
+// containers may be zapped as well; they simply fault back in.
+void unmapObjectPages(struct address_space *mapping, struct MemoryObject* obj, unsigned long index, unsigned long count){
+	// a zero length would mean everything up to the end of the device
+	if(count == 0){
+		return;
+	}
+	unmap_mapping_range(mapping, (loff_t)(obj->objectId + index) << PAGE_SHIFT, (loff_t)count << PAGE_SHIFT, 1);
+}
+
+// Returns the page at index, allocating it on first touch and breaking
+// sharing when the caller is about to write. Called with obj->pageLock held.
+struct page* getObjectPage(struct MemoryObject* obj, unsigned long index, int write){
+	struct page *page;
+	if(loadObjectPage(obj, index)){
+		return(NULL);
+	}
+	page = obj->pages[index];
+	if(page == NULL){
+		page = newObjectPage(obj);
+		obj->pages[index] = page;
+	}else if(write && objectPageShared(page)){
+		struct page *copy = allocObjectPage();
+		if(copy == NULL){
+			return(NULL);
+		}
+		copy_highpage(copy, page);
+		obj->pages[index] = copy;
+		releaseObjectPage(page);
+		page = copy;
+		// other tasks may still map the shared page read-only, make them
+		// fault in the copy
+		if(obj->mapping != NULL){
+			unmapObjectPages(obj->mapping, obj, index, 1);
+		}
+	}
+	return(page);
+}
+
+// Decompresses whatever part of the object was compressed.
+void prepareObjectPages(struct MemoryObject* obj){
+	unsigned long i;
+	lockObjectPages(obj);
+	obj->lastAccess = jiffies;
+	for(i = 0; obj->zPages > 0 && i < obj->nrPages; i++){
+		if(loadObjectPage(obj, i)){
+			break;
+		}
+	}
+	mutex_unlock(&obj->pageLock);
+}
+
+// Compresses the private resident pages of an object with none of them
+// mapped, keeping only the ones that shrink by at least a quarter. Shared
+// pages belong to snapshots or the dedup table and are left alone. Called
+// with obj->pageLock held.
+void compressObjectPages(struct MemoryObject* obj, void *workmem, unsigned char *buffer){
+	unsigned long i;
+	if(obj->zpages == NULL){
+		obj->zpages = kcalloc(obj->nrPages, sizeof(struct CompressedPage *), GFP_KERNEL);
+		if(obj->zpages == NULL){
+			return;
+		}
+	}
+	for(i = 0; i < obj->nrPages; i++){
+		struct page *page = obj->pages[i];
+		struct CompressedPage* zpage;
+		size_t length;
+		int ret;
+		if(page == NULL || objectPageShared(page)){
+			continue;
+		}
+		ret = lz4_compress(kmap(page), PAGE_SIZE, buffer, &length, workmem);
+		kunmap(page);
+		if(ret || length > PAGE_SIZE - PAGE_SIZE / 4){
+			continue;
+		}
+		zpage = kmalloc(sizeof(struct CompressedPage) + length, GFP_KERNEL | __GFP_NOWARN);
+		if(zpage == NULL){
+			break;
+		}
+		zpage->length = length;
+		memcpy(zpage->data, buffer, length);
+		obj->zpages[i] = zpage;
+		obj->zPages++;
+		obj->zBytes += length;
+		obj->pages[i] = NULL;
+		releaseObjectPage(page);
+	}
+}
+
+// Returns the objects of all containers with a reference held on each, or
+// NULL when out of memory.
+struct MemoryObject** grabAllObjects(unsigned long *count){
+	struct MemoryObject** objects;
+	struct Container* container;
+	unsigned long i = 0;
+	*count = 0;
 	mutex_lock(&containerMutex);
-	struct memory_container_cmd* mcontainer;
-	mcontainer = kmalloc(sizeof(struct memory_container_cmd),GFP_KERNEL);
-	long cd = copy_from_user(mcontainer, user_cmd, sizeof(struct memory_container_cmd));
-	struct Container* memoryContainer = getContainerOfTask(current->pid);
-	removeObject(memoryContainer, mcontainer->oid);
+	for(container = containerArray.head; container != NULL; container = container->next){
+		struct MemoryObject* iterator;
+		for(iterator = container->memoryHead; iterator != NULL; iterator = iterator->next){
+			(*count)++;
+		}
+	}
+	objects = kcalloc(*count + 1, sizeof(struct MemoryObject *), GFP_KERNEL);
+	for(container = containerArray.head; objects != NULL && container != NULL; container = container->next){
+		struct MemoryObject* iterator;
+		for(iterator = container->memoryHead; iterator != NULL; iterator = iterator->next){
+			atomic_inc(&iterator->refCount);
+			objects[i++] = iterator;
+		}
+	}
+	mutex_unlock(&containerMutex);
+	return(objects);
+}
+
+// (Re)arms work to run interval seconds from now, or cancels it when the
+// interval is 0 or the module is on its way out. Called with the module's
+// parameter lock held, so it is ordered against writes to the parameter.
+void scheduleIntervalWork(struct delayed_work *work, unsigned int interval, int started){
+	if(started && interval > 0){
+		mod_delayed_work(system_wq, work, interval * HZ);
+	}else{
+		cancel_delayed_work(work);
+	}
+}
+
+static int setCompressInterval(const char *val, const struct kernel_param *kp){
+	int ret = param_set_uint(val, kp);
+	if(ret == 0){
+		scheduleIntervalWork(&compressWork, compress_interval, compressStarted);
+	}
+	return(ret);
+}
+
+// Whether obj has been idle since deadline. A mapped object only counts as
+// idle once a zap from an earlier pass was not followed by any fault;
+// otherwise it is zapped now. Called with obj->pageLock held.
+int checkObjectIdle(struct MemoryObject* obj, unsigned long deadline){
+	if(obj->frozen || READ_ONCE(obj->lockOwner) != 0 || !time_before(obj->lastAccess, deadline)){
+		return(0);
+	}
+	if(atomic_read(&obj->mapCount) == 0 || obj->mapping == NULL){
+		return(1);
+	}
+	if(obj->zappedAt != 0 && time_before(obj->lastAccess, obj->zappedAt)){
+		return(1);
+	}
+	unmapObjectPages(obj->mapping, obj, 0, obj->nrPages);
+	obj->zappedAt = jiffies;
+	return(0);
+}
+
+static void compressColdObjects(struct work_struct *work){
+	unsigned int interval = READ_ONCE(compress_interval);
+	struct MemoryObject** objects = NULL;
+	unsigned long count = 0, i;
+	void *workmem;
+	unsigned char *buffer;
+	if(interval == 0){
+		return;
+	}
+	workmem = vmalloc(LZ4_MEM_COMPRESS);
+	buffer = vmalloc(lz4_compressbound(PAGE_SIZE));
+	if(workmem != NULL && buffer != NULL){
+		objects = grabAllObjects(&count);
+	}
+	if(objects != NULL){
+		unsigned long deadline = jiffies - interval * HZ;
+		for(i = 0; i < count; i++){
+			struct MemoryObject* obj = objects[i];
+			if(mutex_trylock(&obj->pageLock)){
+				if(checkObjectIdle(obj, deadline)){
+					// compressed pages must not stay mapped, and faults
+					// wait on pageLock until they are done
+					if(obj->mapping != NULL){
+						unmapObjectPages(obj->mapping, obj, 0, obj->nrPages);
+					}
+					compressObjectPages(obj, workmem, buffer);
+				}
+				mutex_unlock(&obj->pageLock);
+			}
+			cond_resched();
+		}
+		releaseContainerObjects(objects, count);
+	}
+	vfree(workmem);
+	vfree(buffer);
+	kernel_param_lock(THIS_MODULE);
+	scheduleIntervalWork(&compressWork, compress_interval, compressStarted);
+	kernel_param_unlock(THIS_MODULE);
+}
+
+void memory_container_compress_start(void){
+	kernel_param_lock(THIS_MODULE);
+	compressStarted = 1;
+	scheduleIntervalWork(&compressWork, compress_interval, compressStarted);
+	kernel_param_unlock(THIS_MODULE);
+}
+
+void memory_container_compress_stop(void){
+	kernel_param_lock(THIS_MODULE);
+	compressStarted = 0;
+	kernel_param_unlock(THIS_MODULE);
+	cancel_delayed_work_sync(&compressWork);
+}
+
+// Ends the current working-set window of obj and starts the next one with
+// a fresh sample, which is unmapped so that its next use faults. Objects
+// that grew get a new bitmap; without memory they are just not tracked.
+void startWorkingSetWindow(struct MemoryObject* obj, unsigned int sample, unsigned int phase){
+	unsigned long touched = 0, i, count, end;
+	struct address_space *mapping;
+	lockObjectPages(obj);
+	if(obj->wssBits != NULL){
+		for(i = obj->wssPhase; i < obj->wssPages; i += obj->wssSample){
+			touched += test_bit(i, obj->wssBits);
+		}
+		memmove(obj->wssHistory + 1, obj->wssHistory, sizeof(obj->wssHistory) - sizeof(obj->wssHistory[0]));
+		obj->wssHistory[0] = obj->wssTouched;
+		obj->wssTouched = (u64)min(touched * obj->wssSample, obj->nrPages) << PAGE_SHIFT;
+	}
+	if(obj->nrPages > obj->wssPages || obj->wssBits == NULL){
+		kfree((void *)obj->wssBits);
+		obj->wssBits = kcalloc(BITS_TO_LONGS(obj->nrPages), sizeof(unsigned long), GFP_KERNEL);
+		obj->wssPages = obj->wssBits != NULL ? obj->nrPages : 0;
+	}else{
+		bitmap_zero(obj->wssBits, obj->wssPages);
+	}
+	obj->wssSample = sample;
+	obj->wssPhase = phase;
+	mapping = obj->mapping;
+	if(mapping != NULL && obj->wssBits != NULL){
+		// only resident pages can be mapped; zapping whole ranges would
+		// hit the pages of every object mapped at the same device offsets
+		end = min(obj->wssPages, obj->nrPages);
+		for(i = phase; i < end; i += sample){
+			if(obj->pages[i] == NULL){
+				continue;
+			}
+			// with every page sampled, neighbouring resident pages go together
+			for(count = 1; sample == 1 && i + count < end && obj->pages[i + count] != NULL; count++)
+				;
+			unmapObjectPages(mapping, obj, i, count);
+			i += count - 1;
+		}
+	}
+	mutex_unlock(&obj->pageLock);
+}
+
+static void scanWorkingSets(struct work_struct *work){
+	unsigned int interval = READ_ONCE(wss_interval);
+	unsigned int sample = max_t(unsigned int, READ_ONCE(wss_sample), 1);
+	struct MemoryObject** objects;
+	unsigned long count, i;
+	if(interval == 0){
+		return;
+	}
+	objects = grabAllObjects(&count);
+	if(objects != NULL){
+		for(i = 0; i < count; i++){
+			startWorkingSetWindow(objects[i], sample, wssWindows % sample);
+			cond_resched();
+		}
+		releaseContainerObjects(objects, count);
+		WRITE_ONCE(wssWindows, wssWindows + 1);
+	}
+	kernel_param_lock(THIS_MODULE);
+	scheduleIntervalWork(&wssWork, wss_interval, wssStarted);
+	kernel_param_unlock(THIS_MODULE);
+}
+
+static int setWssInterval(const char *val, const struct kernel_param *kp){
+	int ret = param_set_uint(val, kp);
+	if(ret == 0){
+		scheduleIntervalWork(&wssWork, wss_interval, wssStarted);
+	}
+	return(ret);
+}
+
+void memory_container_wss_start(void){
+	kernel_param_lock(THIS_MODULE);
+	wssStarted = 1;
+	scheduleIntervalWork(&wssWork, wss_interval, wssStarted);
+	kernel_param_unlock(THIS_MODULE);
+}
+
+void memory_container_wss_stop(void){
+	kernel_param_lock(THIS_MODULE);
+	wssStarted = 0;
+	kernel_param_unlock(THIS_MODULE);
+	cancel_delayed_work_sync(&wssWork);
+}
+
+// Drops one reference to an object. The container's list holds one and every
+// VMA mapping the object holds another, so the pages outlive free/delete
+// until the last mapping goes away.
+void putMemoryObject(struct MemoryObject* obj){
+	unsigned long i;
+	if(atomic_dec_and_test(&obj->refCount)){
+		putPagePool(obj->pool);
+		for(i = 0; i < obj->nrPages; i++){
+			if(obj->pages[i] != NULL){
+				releaseObjectPage(obj->pages[i]);
+			}
+			dropCompressedPage(obj, i);
+		}
+		if(obj->headerPage != NULL){
+			put_page(obj->headerPage);
+		}
+		kfree((void *)obj->wssBits);
+		kfree((void *)obj->pages);
+		kfree((void *)obj->zpages);
+		kfree((void *)obj);
+	}
+}
+
+// Returns the container's objects with a reference held on each, so they
+// can be worked on after containerMutex (which must be held) is dropped.
+struct MemoryObject** grabContainerObjects(struct Container* container, unsigned long *count){
+	struct MemoryObject* iterator;
+	struct MemoryObject** objects;
+	unsigned long i = 0;
+	*count = 0;
+	for(iterator = container->memoryHead; iterator != NULL; iterator = iterator->next){
+		(*count)++;
+	}
+	objects = kcalloc(*count + 1, sizeof(struct MemoryObject *), GFP_KERNEL);
+	if(objects == NULL){
+		return(NULL);
+	}
+	for(iterator = container->memoryHead; iterator != NULL; iterator = iterator->next){
+		atomic_inc(&iterator->refCount);
+		objects[i++] = iterator;
+	}
+	return(objects);
+}
+
+void releaseContainerObjects(struct MemoryObject** objects, unsigned long count){
+	unsigned long i;
+	for(i = 0; i < count; i++){
+		putMemoryObject(objects[i]);
+	}
+	kfree((void *)objects);
+}
+
+// Looks up object oid of the caller's container and returns it with a
+// reference held, or NULL.
+struct MemoryObject* grabTaskObject(unsigned long oid, int *readOnly){
+	struct Container* container;
+	struct MemoryObject* obj = NULL;
+	mutex_lock(&containerMutex);
+	container = getContainerOfTask(current->pid);
+	if(container != NULL){
+		obj = getContainerMemoryObject(container, oid);
+	}
+	if(obj != NULL){
+		atomic_inc(&obj->refCount);
+		if(readOnly != NULL){
+			*readOnly = container->readOnly;
+		}
+	}
+	mutex_unlock(&containerMutex);
+	return(obj);
+}
+
+// Like grabTaskObject() but creates the object when it does not exist yet,
+// for callers about to write to it. Returns an ERR_PTR on failure.
+struct MemoryObject* grabWritableTaskObject(unsigned long oid){
+	struct Container* container;
+	struct MemoryObject* obj;
+	mutex_lock(&containerMutex);
+	container = getContainerOfTask(current->pid);
+	if(container == NULL || container->readOnly){
+		mutex_unlock(&containerMutex);
+		return(ERR_PTR(container == NULL ? -ENOENT : -EROFS));
+	}
+	obj = getContainerMemoryObject(container, oid);
+	if(obj == NULL){
+		obj = createMemoryObject(oid);
+		addMemoryToContainer(container, obj);
+	}
+	atomic_inc(&obj->refCount);
+	mutex_unlock(&containerMutex);
+	return(obj);
+}
+
+// Releases up to budget pages from the end of an object only its detached
+// container still holds, and returns how many were released. Nobody can
+// look the object up anymore, so its pages are ours without pageLock.
+int releaseObjectTail(struct MemoryObject* obj, int budget){
+	int released = 0;
+	while(released < budget && obj->nrPages > 0){
+		unsigned long i = obj->nrPages - 1;
+		if(obj->pages[i] != NULL){
+			releaseObjectPage(obj->pages[i]);
+			obj->pages[i] = NULL;
+			released++;
+		}else if(obj->zpages != NULL && obj->zpages[i] != NULL){
+			released++;
+		}
+		dropCompressedPage(obj, i);
+		obj->nrPages = i;
+	}
+	return(released);
+}
+
+// Frees up to budget pages, tasks and objects of a detached container and
+// returns how much of the budget that took. Objects give up their pages
+// over as many passes as needed before they are put; one that is still
+// mapped or watched is put at once and freed by its last holder.
+int reclaimContainerBatch(struct Container* container, int budget){
+	int freed = 0;
+	while(freed < budget && container->head != NULL){
+		struct Node* node = container->head;
+		container->head = node->next;
+		freeNode(node);
+		freed++;
+	}
+	while(freed < budget && container->memoryHead != NULL){
+		struct MemoryObject* obj = container->memoryHead;
+		detachMemoryObject(obj);
+		if(atomic_read(&obj->refCount) == 1){
+			freed += releaseObjectTail(obj, budget - freed);
+			if(obj->nrPages > 0){
+				break;
+			}
+		}
+		container->memoryHead = obj->next;
+		putMemoryObject(obj);
+		freed++;
+	}
+	return(freed);
+}
+
+static void reclaimContainers(struct work_struct *work){
+	int budget = RECLAIM_BATCH;
+	struct Container* container;
+	while(budget > 0){
+		spin_lock(&reclaimLock);
+		container = reclaimHead;
+		if(container != NULL){
+			reclaimHead = container->next;
+		}
+		spin_unlock(&reclaimLock);
+		if(container == NULL){
+			return;
+		}
+		budget -= reclaimContainerBatch(container, budget);
+		if(container->head != NULL || container->memoryHead != NULL){
+			// out of budget, resume with this container on the next pass
+			queueContainerReclaim(container);
+			return;
+		}
+		putPagePool(container->pool);
+		kfree((void *)container);
+	}
+	spin_lock(&reclaimLock);
+	if(reclaimHead != NULL){
+		schedule_work(&reclaimWork);
+	}
+	spin_unlock(&reclaimLock);
+}
+
+// Called once the device is gone: detaches whatever containers are left,
+// snapshots nobody released in particular, and waits for them to be freed.
+void memory_container_reclaim_drain(void){
+	mutex_lock(&containerMutex);
+	while(containerArray.head != NULL){
+		deleteContainer(containerArray.head);
+	}
+	mutex_unlock(&containerMutex);
+	do{
+		flush_work(&reclaimWork);
+	}while(READ_ONCE(reclaimHead) != NULL);
+}
+
+int removeObject(struct Container* container, unsigned long oid){
+	//printk("inside custom remove object function\n");
+	struct MemoryObject* iterator = container->memoryHead;
+	struct MemoryObject* previous = NULL;
+	while(iterator!=NULL){
+		if(iterator->objectId == oid){
+			//printk("inside if of custom remove object function\n");
+			break;
+		}
+		previous = iterator;
+		iterator = iterator->next;
+	}
+	if(previous==NULL && iterator->objectId == oid){
+		//printk("inside second if of custom remove object function\n");
+		container->memoryHead = iterator->next;
+	}else{
+		//printk("inside third if of custom remove object function\n");
+		previous->next = iterator->next;
+	}
+	detachMemoryObject(iterator);
+	// watchers learn the object is gone through a final change
+	publishObjectChange(iterator);
+	putMemoryObject(iterator);
+	//printk("before return of custom remove object function\n");
+	return(NULL);
+}
+
+int addMemoryToContainer(struct Container* container, struct MemoryObject* memory){
+	//printk("inside custom add memory to container function\n");
+	
+	struct MemoryObject* iterator = container->memoryHead;
+	struct MemoryObject* previous = NULL;
+	if(container->pool != NULL && memory->pool == NULL){
+		atomic_inc(&container->pool->refCount);
+		memory->pool = container->pool;
+	}
+	while(iterator != NULL){
+		previous = iterator;
+		iterator = iterator->next;
+	}
+	if(previous == NULL){
+		container->memoryHead = memory;
+	}else{
+		previous->next = memory;
+	}
+	//printk("before return of custom add memory to container\n");
+	return(1);
+}
+
+static void memory_container_vm_open(struct vm_area_struct *vma)
+{
+	struct MemoryObject* obj = vma->vm_private_data;
+	atomic_inc(&obj->mapCount);
+	atomic_inc(&obj->refCount);
+}
+
+static void memory_container_vm_close(struct vm_area_struct *vma)
+{
+	struct MemoryObject* obj = vma->vm_private_data;
+	obj->lastAccess = jiffies;
+	atomic_dec(&obj->mapCount);
+	putMemoryObject(obj);
+}
+
+// Maps up to count pages following index into vma so that a scan does not
+// take a fault on every page. They go in read-only like any other page and
+// still pass through page_mkwrite on the first write. Called with
+// obj->pageLock held.
+static void mapObjectPagesAhead(struct vm_area_struct *vma, struct MemoryObject* obj, unsigned long index, unsigned long count){
+	unsigned long addr = vma->vm_start + ((index + 1) << PAGE_SHIFT);
+	unsigned long j;
+	for(j = index + 1; j <= index + count && j < obj->nrPages && addr < vma->vm_end; j++, addr += PAGE_SIZE){
+		struct page *page;
+		// leave working-set samples to fault when they are really used
+		if(workingSetPending(obj, j)){
+			continue;
+		}
+		page = getObjectPage(obj, j, 0);
+		if(page == NULL){
+			break;
+		}
+		// -EBUSY just means this one is already mapped
+		vm_insert_page(vma, addr, page);
+	}
+}
+
+static int memory_container_vm_fault(struct vm_area_struct *vma, struct vm_fault *vmf)
+{
+	struct MemoryObject* obj = vma->vm_private_data;
+	unsigned long index = ((unsigned long)vmf->virtual_address - vma->vm_start) >> PAGE_SHIFT;
+	struct page *page;
+	lockObjectPages(obj);
+	if(index >= obj->nrPages){
+		mutex_unlock(&obj->pageLock);
+		return VM_FAULT_SIGBUS;
+	}
+	obj->lastAccess = jiffies;
+	noteObjectAccess(obj, index);
+	page = getObjectPage(obj, index, vmf->flags & FAULT_FLAG_WRITE);
+	if(page == NULL){
+		mutex_unlock(&obj->pageLock);
+		return VM_FAULT_OOM;
+	}
+	get_page(page);
+	if(index >= obj->willStart && index < obj->willEnd){
+		mapObjectPagesAhead(vma, obj, index, min_t(unsigned long, obj->willEnd - index - 1, MAP_AHEAD_WILLNEED));
+	}else if(obj->advice == MCONTAINER_ADVICE_SEQUENTIAL){
+		mapObjectPagesAhead(vma, obj, index, MAP_AHEAD_SEQUENTIAL);
+	}
+	mutex_unlock(&obj->pageLock);
+	vmf->page = page;
+	return 0;
+}
+
+// Shared mappings with a page_mkwrite hook are installed read-only, so the
+// first write to every page lands here and can break copy-on-write sharing.
+static int memory_container_vm_page_mkwrite(struct vm_area_struct *vma, struct vm_fault *vmf)
+{
+	struct MemoryObject* obj = vma->vm_private_data;
+	unsigned long index = ((unsigned long)vmf->virtual_address - vma->vm_start) >> PAGE_SHIFT;
+	struct page *page;
+	lockObjectPages(obj);
+	page = getObjectPage(obj, index, 1);
+	if(page != vmf->page){
+		// the mapped page was copied, drop the stale pte and fault again
+		mutex_unlock(&obj->pageLock);
+		if(page == NULL){
+			return VM_FAULT_OOM;
+		}
+		unmapObjectPages(vma->vm_file->f_mapping, obj, index, 1);
+		return VM_FAULT_NOPAGE;
+	}
+	lock_page(page);
+	mutex_unlock(&obj->pageLock);
+	noteObjectWrite(obj);
+	return VM_FAULT_LOCKED;
+}
+
+static const struct vm_operations_struct memory_container_vm_ops = {
+	.open = memory_container_vm_open,
+	.close = memory_container_vm_close,
+	.fault = memory_container_vm_fault,
+	.page_mkwrite = memory_container_vm_page_mkwrite,
+};
+
+static void memory_container_header_vm_open(struct vm_area_struct *vma)
+{
+	struct MemoryObject* obj = vma->vm_private_data;
+	atomic_inc(&obj->refCount);
+}
+
+static void memory_container_header_vm_close(struct vm_area_struct *vma)
+{
+	putMemoryObject(vma->vm_private_data);
+}
+
+static int memory_container_header_vm_fault(struct vm_area_struct *vma, struct vm_fault *vmf)
+{
+	struct MemoryObject* obj = vma->vm_private_data;
+	get_page(obj->headerPage);
+	vmf->page = obj->headerPage;
+	return 0;
+}
+
+// The header page is never copied or compressed, so writes need no
+// page_mkwrite and the pte can go in writable straight away.
+static const struct vm_operations_struct memory_container_header_vm_ops = {
+	.open = memory_container_header_vm_open,
+	.close = memory_container_header_vm_close,
+	.fault = memory_container_header_vm_fault,
+};
+
+// Maps the version header of an existing object. The page is allocated on
+// first use so objects nobody reads optimistically do not pay for it.
+static int mapObjectHeader(struct vm_area_struct *vma){
+	unsigned long objectId = vma->vm_pgoff & ~(unsigned long)MCONTAINER_HEADER_PAGE;
+	struct MemoryObject* obj;
+	if(vma->vm_end - vma->vm_start != PAGE_SIZE){
+		return -EINVAL;
+	}
+	obj = grabTaskObject(objectId, NULL);
+	if(obj == NULL){
+		return -ENOENT;
+	}
+	mutex_lock(&obj->pageLock);
+	if(obj->headerPage == NULL){
+		obj->headerPage = alloc_page(GFP_KERNEL | __GFP_ZERO);
+	}
+	mutex_unlock(&obj->pageLock);
+	if(obj->headerPage == NULL){
+		putMemoryObject(obj);
+		return -ENOMEM;
+	}
+	vma->vm_flags |= VM_DONTEXPAND | VM_DONTDUMP;
+	vma->vm_private_data = obj;
+	vma->vm_ops = &memory_container_header_vm_ops;
+	return 0;
+}
+
+int memory_container_mmap(struct file *filp, struct vm_area_struct *vma)
+{
+	//printk("inside default memory container mmap\n");
+	if(vma->vm_pgoff & MCONTAINER_HEADER_PAGE){
+		return mapObjectHeader(vma);
+	}
+	mutex_lock(&containerMutex);
+	unsigned long nrPages = (vma->vm_end - vma->vm_start) >> PAGE_SHIFT;
+	unsigned long objectId = vma->vm_pgoff;
+	int ret = 0;
+	struct Container* currentContainer = getContainerOfTask(current->pid);
+	if(currentContainer == NULL){
+		mutex_unlock(&containerMutex);
+		return -ENOENT;
+	}
+	struct MemoryObject* objToCheck = getContainerMemoryObject(currentContainer, objectId);
+	int readOnly = currentContainer->readOnly;
+	if(readOnly){
+		// snapshots can only be mapped for reading and never grow
+		if(objToCheck == NULL || (vma->vm_flags & VM_WRITE)){
+			mutex_unlock(&containerMutex);
+			return objToCheck == NULL ? -ENOENT : -EACCES;
+		}
+		vma->vm_flags &= ~VM_MAYWRITE;
+	}
+	if(objToCheck == NULL){
+		objToCheck = createMemoryObject(objectId);
+		addMemoryToContainer(currentContainer, objToCheck);
+	}
+	atomic_inc(&objToCheck->refCount);
+	mutex_unlock(&containerMutex);
+	if(!readOnly){
+		lockObjectPages(objToCheck);
+		ret = resizeObjectPages(objToCheck, nrPages);
+		mutex_unlock(&objToCheck->pageLock);
+	}
+	if(ret){
+		putMemoryObject(objToCheck);
+		return ret;
+	}
+	// VM_MIXEDMAP lets the fault handler vm_insert_page() pages ahead
+	vma->vm_flags |= VM_DONTEXPAND | VM_DONTDUMP | VM_MIXEDMAP;
+	WRITE_ONCE(objToCheck->mapping, filp->f_mapping);
+	atomic_inc(&objToCheck->mapCount);
+	vma->vm_private_data = objToCheck;
+	vma->vm_ops = &memory_container_vm_ops;
+	//printk("before return of default memory container mmap\n");
+    	return 0;
+}
+
+
+int memory_container_lock(struct memory_container_cmd __user *user_cmd)
+{
+	//printk("Inside container lock");
+	struct memory_container_cmd mcontainer;
+	struct Container* containerMemory;
+	struct MemoryObject* memObj;
+	int ret;
+	if(copy_from_user(&mcontainer, user_cmd, sizeof(struct memory_container_cmd))){
+		return -EFAULT;
+	}
+	do{
+		mutex_lock(&containerMutex);
+		containerMemory = getContainerOfTask(current->pid);
+		if(containerMemory == NULL){
+			mutex_unlock(&containerMutex);
+			return -ENOENT;
+		}
+		memObj = getContainerMemoryObject(containerMemory, mcontainer.oid);
+		if(memObj == NULL && containerMemory->readOnly){
+			mutex_unlock(&containerMutex);
+			return -ENOENT;
+		}
+		if(memObj == NULL){
+			//printk("inside if of default container lock\n");
+			memObj = createMemoryObject(mcontainer.oid);
+			addMemoryToContainer(containerMemory, memObj);
+		}
+		// keep the object alive while we sleep without containerMutex
+		atomic_inc(&memObj->refCount);
+		mutex_unlock(&containerMutex);
+		ret = lockMemoryObject(memObj);
+		if(ret == 0 || ret == -EOWNERDEAD){
+			// the holder is about to touch the object, bring it back now
+			prepareObjectPages(memObj);
+		}
+		putMemoryObject(memObj);
+	}while(ret == -EAGAIN);
+	//printk("before return of default container lock\n");
+	return ret;
+}
+
+
+int memory_container_unlock(struct memory_container_cmd __user *user_cmd)
+{
+	//printk("inside container unlock");
+	struct memory_container_cmd mcontainer;
+	struct Container* memoryContainer;
+	struct MemoryObject* memObj;
+	int ret = 0;
+	if(copy_from_user(&mcontainer, user_cmd, sizeof(struct memory_container_cmd))){
+		return -EFAULT;
+	}
+	mutex_lock(&containerMutex);
+	memoryContainer = getContainerOfTask(current->pid);
+	if(memoryContainer != NULL){
+		memObj = getContainerMemoryObject(memoryContainer, mcontainer.oid);
+		if(memObj!=NULL){
+			ret = unlockMemoryObject(memObj, current->pid);
+		}
+	}
+	mutex_unlock(&containerMutex);
+	//printk("before return of container unlock\n");
+	return ret;
+}
+
+
+// Lock sets are taken in ascending oid order, so two of them can never wait
+// on each other in a cycle.
+#define LOCKSET_MAX 1024
+
+static int compareObjectIds(const void *a, const void *b)
+{
+	u64 x = *(const u64 *)a, y = *(const u64 *)b;
+	return x < y ? -1 : x > y;
+}
+
+// Copies in the oids of a lock set, sorted and without duplicates.
+u64* copyLockSet(struct memory_container_lockset_cmd* cmd, unsigned long *count){
+	unsigned long i, n = 1;
+	u64 *oids;
+	if(cmd->count == 0 || cmd->count > LOCKSET_MAX){
+		return(ERR_PTR(cmd->count == 0 ? -EINVAL : -E2BIG));
+	}
+	oids = kmalloc_array(cmd->count, sizeof(u64), GFP_KERNEL);
+	if(oids == NULL){
+		return(ERR_PTR(-ENOMEM));
+	}
+	if(copy_from_user(oids, (const void __user *)(unsigned long)cmd->oids, cmd->count * sizeof(u64))){
+		kfree((void *)oids);
+		return(ERR_PTR(-EFAULT));
+	}
+	sort(oids, cmd->count, sizeof(u64), compareObjectIds, NULL);
+	for(i = 1; i < cmd->count; i++){
+		if(oids[i] != oids[n - 1]){
+			oids[n++] = oids[i];
+		}
+	}
+	*count = n;
+	return(oids);
+}
+
+// Finds or creates the objects of a lock set with a reference held on each.
+int grabLockSetObjects(u64 *oids, struct MemoryObject** objects, unsigned long count){
+	struct Container* container;
+	unsigned long i;
+	mutex_lock(&containerMutex);
+	container = getContainerOfTask(current->pid);
+	if(container == NULL){
+		mutex_unlock(&containerMutex);
+		return(-ENOENT);
+	}
+	for(i = 0; i < count; i++){
+		struct MemoryObject* obj = getContainerMemoryObject(container, oids[i]);
+		if(obj == NULL && container->readOnly){
+			while(i > 0){
+				putMemoryObject(objects[--i]);
+			}
+			mutex_unlock(&containerMutex);
+			return(-ENOENT);
+		}
+		if(obj == NULL){
+			obj = createMemoryObject(oids[i]);
+			addMemoryToContainer(container, obj);
+		}
+		atomic_inc(&obj->refCount);
+		objects[i] = obj;
+	}
+	mutex_unlock(&containerMutex);
+	return(0);
+}
+
+/**
+ * takes the locks of all objects in the set or none of them, within
+ * cmd.timeout_ms milliseconds (0 waits for ever). Returns -EOWNERDEAD with
+ * all locks held if any of them was abandoned by a task that went away.
+ */
+int memory_container_lock_set(struct memory_container_lockset_cmd __user *user_cmd)
+{
+	struct memory_container_lockset_cmd mcontainer;
+	struct MemoryObject** objects;
+	unsigned long *abandonedBits;
+	unsigned long count = 0, i, taken;
+	long timeout;
+	int ret, abandoned = 0;
+	u64 *oids;
+	if(copy_from_user(&mcontainer, user_cmd, sizeof(struct memory_container_lockset_cmd))){
+		return -EFAULT;
+	}
+	oids = copyLockSet(&mcontainer, &count);
+	if(IS_ERR(oids)){
+		return PTR_ERR(oids);
+	}
+	objects = kcalloc(count, sizeof(struct MemoryObject *), GFP_KERNEL);
+	abandonedBits = kcalloc(BITS_TO_LONGS(count), sizeof(unsigned long), GFP_KERNEL);
+	if(objects == NULL || abandonedBits == NULL){
+		kfree((void *)objects);
+		kfree((void *)abandonedBits);
+		kfree((void *)oids);
+		return -ENOMEM;
+	}
+	timeout = mcontainer.timeout_ms ? (long)msecs_to_jiffies(mcontainer.timeout_ms) : MAX_SCHEDULE_TIMEOUT;
+	do{
+		if((ret = grabLockSetObjects(oids, objects, count))){
+			break;
+		}
+		abandoned = 0;
+		bitmap_zero(abandonedBits, count);
+		for(taken = 0; taken < count; taken++){
+			ret = lockMemoryObjectTimeout(objects[taken], &timeout);
+			if(ret == -EOWNERDEAD){
+				set_bit(taken, abandonedBits);
+				abandoned = 1;
+				ret = 0;
+			}
+			if(ret){
+				break;
+			}
+		}
+		for(i = 0; i < taken; i++){
+			if(ret){
+				rollbackMemoryObjectLock(objects[i], test_bit(i, abandonedBits));
+			}else{
+				prepareObjectPages(objects[i]);
+			}
+		}
+		for(i = 0; i < count; i++){
+			putMemoryObject(objects[i]);
+		}
+		// -EAGAIN: an object was freed while we waited, look the set up again
+	}while(ret == -EAGAIN);
+	kfree((void *)objects);
+	kfree((void *)abandonedBits);
+	kfree((void *)oids);
+	if(ret == 0 && abandoned){
+		ret = -EOWNERDEAD;
+	}
+	return ret;
+}
+
+
+int memory_container_unlock_set(struct memory_container_lockset_cmd __user *user_cmd)
+{
+	struct memory_container_lockset_cmd mcontainer;
+	struct Container* container;
+	unsigned long count = 0, i;
+	int ret = 0;
+	u64 *oids;
+	if(copy_from_user(&mcontainer, user_cmd, sizeof(struct memory_container_lockset_cmd))){
+		return -EFAULT;
+	}
+	oids = copyLockSet(&mcontainer, &count);
+	if(IS_ERR(oids)){
+		return PTR_ERR(oids);
+	}
+	mutex_lock(&containerMutex);
+	container = getContainerOfTask(current->pid);
+	for(i = 0; container != NULL && i < count; i++){
+		struct MemoryObject* obj = getContainerMemoryObject(container, oids[i]);
+		int n = obj != NULL ? unlockMemoryObject(obj, current->pid) : 0;
+		if(ret == 0){
+			ret = n;
+		}
+	}
+	mutex_unlock(&containerMutex);
+	kfree((void *)oids);
+	return container == NULL ? -ENOENT : ret;
+}
+
+
+int memory_container_delete(struct memory_container_cmd __user *user_cmd)
+{
+	//printk("inside container delete");
+	mutex_lock(&containerMutex);
+	struct Container* containerOfTask = getContainerOfTask(current->pid);
+	if(containerOfTask == NULL){
+		mutex_unlock(&containerMutex);
+		return -ENOENT;
+	}
+	abandonObjectLocks(containerOfTask, current->pid);
+	int n = deleteTaskFromContainer(current->pid, containerOfTask);
+	if(checkIfEmptyContainer(containerOfTask) == 1){
+		//printk("inside if of container delete\n");
+		// detach now, the object tree is freed by the reclaim worker
+		deleteContainer(containerOfTask);
+	}
+	mutex_unlock(&containerMutex);
+	//printk("before return of container delete\n");
+	return 0;
+}
+
+
+// Adds the calling task to container cid, creating it first if needed.
+// Called with containerMutex held.
+struct Container* joinContainer(struct file *filp, u64 cid){
+	struct Container* containerExist;
+	// a task that exited unseen may have left its pid to the caller
+	removeTasks(NULL, NULL);
+	containerExist = checkIfContainerExist(cid);
+	if(containerExist == NULL){
+		//printk("inside if of default container create\n");
+		containerExist = createContainer(cid);
+		addContainerToList(containerExist);
+	}
+	// a snapshot lives on without tasks until someone joins and leaves it
+	containerExist->pinnedBy = NULL;
+	struct Node* newNode = createNode(current->pid, current, filp);
+	addNodeToContainer(containerExist, newNode);
+	return(containerExist);
+}
+
+int memory_container_create(struct file *filp, struct memory_container_cmd __user *user_cmd)
+{
+	//printk("Inside container create");
+	struct memory_container_cmd mcontainer;
+	if(copy_from_user(&mcontainer, user_cmd, sizeof(struct memory_container_cmd))){
+		return -EFAULT;
+	}
+	mutex_lock(&containerMutex);
+	joinContainer(filp, mcontainer.cid);
+	mutex_unlock(&containerMutex);
+	//printk("before return of default container create\n");
+    	return 0;
+}
+
+/**
+ * creates or joins container cmd.cid like create, and keeps cmd.pages
+ * pre-zeroed pages (at most POOL_MAX_PAGES) ready for its objects. A later
+ * call replaces the hint; 0 stops refilling the pool.
+ */
+int memory_container_create_pooled(struct file *filp, struct memory_container_pool_cmd __user *user_cmd)
+{
+	struct memory_container_pool_cmd mcontainer;
+	struct Container* container;
+	struct MemoryObject* iterator;
+	unsigned long target;
+	int ret = 0;
+	if(copy_from_user(&mcontainer, user_cmd, sizeof(struct memory_container_pool_cmd))){
+		return -EFAULT;
+	}
+	target = min_t(u64, mcontainer.pages, POOL_MAX_PAGES);
+	mutex_lock(&containerMutex);
+	container = joinContainer(filp, mcontainer.cid);
+	if(container->readOnly){
+		// snapshots never allocate pages
+	}else if(container->pool != NULL){
+		WRITE_ONCE(container->pool->target, target);
+	}else if((container->pool = createPagePool(target)) == NULL){
+		// undo the join, the caller is told the call failed
+		deleteTaskFromContainer(current->pid, container);
+		if(checkIfEmptyContainer(container) == 1){
+			deleteContainer(container);
+		}
+		ret = -ENOMEM;
+	}else{
+		for(iterator = container->memoryHead; iterator != NULL; iterator = iterator->next){
+			if(iterator->pool == NULL){
+				atomic_inc(&container->pool->refCount);
+				iterator->pool = container->pool;
+			}
+		}
+	}
+	mutex_unlock(&containerMutex);
+	if(ret == 0 && target > 0){
+		schedule_delayed_work(&poolWork, 0);
+	}
+	return ret;
+}
+
+
+int memory_container_free(struct memory_container_cmd __user *user_cmd)
+{
+	//printk("inside container free");
+	struct memory_container_cmd mcontainer;
+	if(copy_from_user(&mcontainer, user_cmd, sizeof(struct memory_container_cmd))){
+		return -EFAULT;
+	}
+	mutex_lock(&containerMutex);
+	struct Container* memoryContainer = getContainerOfTask(current->pid);
+	if(memoryContainer == NULL || getContainerMemoryObject(memoryContainer, mcontainer.oid) == NULL){
+		mutex_unlock(&containerMutex);
+		return -ENOENT;
+	}
+	if(memoryContainer->readOnly){
+		mutex_unlock(&containerMutex);
+		return -EROFS;
+	}
+	removeObject(memoryContainer, mcontainer.oid);
+	mutex_unlock(&containerMutex);
+	//printk("before return of container free\n");
+	return 0;
+}
+
+
+/**
+ * creates the read-only container cmd.cid as a point-in-time copy of the
+ * caller's container. Object pages are shared copy-on-write, so this only
+ * costs metadata; every source object is frozen and write-protected before
+ * any is shared so the copy is consistent across objects. cmd.cid only
+ * appears once the copy is complete.
+ */
+int memory_container_snapshot(struct file *filp, struct memory_container_cmd __user *user_cmd)
+{
+	struct memory_container_cmd mcontainer;
+	struct Container* source;
+	struct Container* snapshot;
+	struct MemoryObject** objects;
+	struct MemoryObject** clones;
+	struct MemoryObject* tail = NULL;
+	unsigned long count = 0, i, j;
+	int ret = 0;
+	if(copy_from_user(&mcontainer, user_cmd, sizeof(struct memory_container_cmd))){
+		return -EFAULT;
+	}
+	mutex_lock(&containerMutex);
+	source = getContainerOfTask(current->pid);
+	if(source == NULL){
+		mutex_unlock(&containerMutex);
+		return -ENOENT;
+	}
+	if(checkIfContainerExist(mcontainer.cid) != NULL){
+		mutex_unlock(&containerMutex);
+		return -EEXIST;
+	}
+	objects = grabContainerObjects(source, &count);
+	clones = kcalloc(count + 1, sizeof(struct MemoryObject *), GFP_KERNEL);
+	if(objects == NULL || clones == NULL){
+		mutex_unlock(&containerMutex);
+		if(objects != NULL){
+			releaseContainerObjects(objects, count);
+		}
+		kfree((void *)clones);
+		return -ENOMEM;
+	}
+	snapshot = createContainer(mcontainer.cid);
+	snapshot->readOnly = 1;
+	snapshot->pinnedBy = filp;
+	// nobody can reach the snapshot or its clones until it is published
+	for(i = 0; i < count; i++){
+		clones[i] = createMemoryObject(objects[i]->objectId);
+		if(tail == NULL){
+			snapshot->memoryHead = clones[i];
+		}else{
+			tail->next = clones[i];
+		}
+		tail = clones[i];
+	}
+	mutex_unlock(&containerMutex);
+
+	// freeze and write-protect everything first, so later writes fault and
+	// wait instead of landing in pages that are about to be shared
+	for(i = 0; i < count; i++){
+		mutex_lock(&objects[i]->pageLock);
+		objects[i]->frozen++;
+		mutex_unlock(&objects[i]->pageLock);
+		unmapObjectPages(filp->f_mapping, objects[i], 0, objects[i]->nrPages);
+	}
+	for(i = 0; i < count; i++){
+		mutex_lock(&objects[i]->pageLock);
+		if(ret == 0 && resizeObjectPages(clones[i], objects[i]->nrPages)){
+			ret = -ENOMEM;
+		}
+		for(j = 0; ret == 0 && j < objects[i]->nrPages; j++){
+			if(loadObjectPage(objects[i], j)){
+				ret = -ENOMEM;
+			}else if(objects[i]->pages[j] != NULL){
+				shareObjectPage(objects[i]->pages[j]);
+				clones[i]->pages[j] = objects[i]->pages[j];
+			}
+		}
+		objects[i]->frozen--;
+		mutex_unlock(&objects[i]->pageLock);
+	}
+	wake_up_all(&snapshotWait);
+	releaseContainerObjects(objects, count);
+	kfree((void *)clones);
+	mutex_lock(&containerMutex);
+	// publish only complete snapshots, and only if cid is still free
+	if(ret == 0 && checkIfContainerExist(mcontainer.cid) != NULL){
+		ret = -EEXIST;
+	}
+	if(ret == 0){
+		addContainerToList(snapshot);
+	}
+	mutex_unlock(&containerMutex);
+	if(ret){
+		queueContainerReclaim(snapshot);
+	}
+	return ret;
+}
+
+
+/**
+ * marks object cmd.oid of the caller's container read-only for the purpose
+ * of deduplication: its pages are merged with identical pages of any
+ * container and are copied again only if someone writes to them.
+ */
+int memory_container_mark_readonly(struct file *filp, struct memory_container_cmd __user *user_cmd)
+{
+	struct memory_container_cmd mcontainer;
+	struct MemoryObject* obj;
+	unsigned long i;
+	if(copy_from_user(&mcontainer, user_cmd, sizeof(struct memory_container_cmd))){
+		return -EFAULT;
+	}
+	obj = grabTaskObject(mcontainer.oid, NULL);
+	if(obj == NULL){
+		return -ENOENT;
+	}
+	lockObjectPages(obj);
+	// writable mappings must be gone before a page is hashed and published,
+	// and faults wait on pageLock until every page has been merged
+	unmapObjectPages(filp->f_mapping, obj, 0, obj->nrPages);
+	for(i = 0; i < obj->nrPages; i++){
+		dedupObjectPage(obj, i);
+		cond_resched();
+	}
+	mutex_unlock(&obj->pageLock);
+	putMemoryObject(obj);
+	return 0;
+}
+
+
+/**
+ * applies an access pattern hint to bytes [offset, offset + length) of an
+ * object, length 0 meaning up to its end. WILLNEED populates the pages now
+ * and maps them ahead on fault, DONTNEED drops them so they read back as
+ * zeroes, and SEQUENTIAL/RANDOM set how far faults map ahead.
+ */
+int memory_container_advise(struct file *filp, struct memory_container_advise_cmd __user *user_cmd)
+{
+	struct memory_container_advise_cmd mcontainer;
+	struct MemoryObject* obj;
+	unsigned long first, last, j;
+	int readOnly = 0, ret = 0;
+	if(copy_from_user(&mcontainer, user_cmd, sizeof(struct memory_container_advise_cmd))){
+		return -EFAULT;
+	}
+	if(mcontainer.offset + mcontainer.length < mcontainer.offset){
+		return -EINVAL;
+	}
+	obj = grabTaskObject(mcontainer.oid, &readOnly);
+	if(obj == NULL){
+		return -ENOENT;
+	}
+	lockObjectPages(obj);
+	first = mcontainer.offset >> PAGE_SHIFT;
+	last = mcontainer.length == 0 ? obj->nrPages : DIV_ROUND_UP(mcontainer.offset + mcontainer.length, PAGE_SIZE);
+	last = min(last, obj->nrPages);
+	switch(mcontainer.advice){
+	case MCONTAINER_ADVICE_NORMAL:
+	case MCONTAINER_ADVICE_RANDOM:
+	case MCONTAINER_ADVICE_SEQUENTIAL:
+		obj->advice = mcontainer.advice;
+		break;
+	case MCONTAINER_ADVICE_WILLNEED:
+		if(first >= last){
+			// nothing of the object in range
+			break;
+		}
+		for(j = first; j < last; j++){
+			if(getObjectPage(obj, j, 0) == NULL){
+				ret = -ENOMEM;
+				break;
+			}
+		}
+		obj->willStart = first;
+		obj->willEnd = last;
+		break;
+	case MCONTAINER_ADVICE_DONTNEED:
+		if(readOnly){
+			ret = -EROFS;
+			break;
+		}
+		if(first >= last){
+			break;
+		}
+		for(j = first; j < last; j++){
+			u64 start = max_t(u64, (u64)j << PAGE_SHIFT, mcontainer.offset);
+			u64 end = (u64)(j + 1) << PAGE_SHIFT;
+			if(mcontainer.length != 0){
+				end = min_t(u64, end, mcontainer.offset + mcontainer.length);
+			}
+			if(end - start == PAGE_SIZE){
+				if(obj->pages[j] != NULL){
+					releaseObjectPage(obj->pages[j]);
+					obj->pages[j] = NULL;
+				}
+				dropCompressedPage(obj, j);
+			}else{
+				// partial page at either end, zero just the covered bytes
+				struct page *page = getObjectPage(obj, j, 1);
+				if(page == NULL){
+					ret = -ENOMEM;
+					break;
+				}
+				memset((char *)kmap(page) + (start & ~PAGE_MASK), 0, end - start);
+				kunmap(page);
+			}
+		}
+		if(obj->willEnd > first && obj->willStart < last){
+			obj->willStart = obj->willEnd = 0;
+		}
+		unmapObjectPages(filp->f_mapping, obj, first, last - first);
+		break;
+	default:
+		ret = -EINVAL;
+	}
+	mutex_unlock(&obj->pageLock);
+	if(ret == 0 && mcontainer.advice == MCONTAINER_ADVICE_DONTNEED){
+		noteObjectWrite(obj);
+	}
+	putMemoryObject(obj);
+	return ret;
+}
+
+
+/**
+ * reports memory usage of the caller's container, including how well its
+ * cold objects compress and what bringing them back has cost so far.
+ */
+int memory_container_get_stats(struct memory_container_stats __user *user_stats)
+{
+	struct memory_container_stats stats;
+	struct Container* container;
+	struct MemoryObject** objects;
+	unsigned long count = 0, i, j, pooled = 0;
+	mutex_lock(&containerMutex);
+	container = getContainerOfTask(current->pid);
+	objects = container != NULL ? grabContainerObjects(container, &count) : NULL;
+	if(container != NULL && container->pool != NULL){
+		pooled = READ_ONCE(container->pool->count);
+	}
+	mutex_unlock(&containerMutex);
+	if(objects == NULL){
+		return container == NULL ? -ENOENT : -ENOMEM;
+	}
+	memset(&stats, 0, sizeof(stats));
+	stats.objects = count;
+	stats.pooled_pages = pooled;
+	for(i = 0; i < count; i++){
+		mutex_lock(&objects[i]->pageLock);
+		for(j = 0; j < objects[i]->nrPages; j++){
+			if(objects[i]->pages[j] != NULL){
+				stats.resident_bytes += PAGE_SIZE;
+			}
+		}
+		stats.compressed_pages += objects[i]->zPages;
+		stats.compressed_bytes += objects[i]->zBytes;
+		stats.decompressions += objects[i]->decompressions;
+		stats.decompress_ns += objects[i]->decompressNs;
+		stats.working_set_bytes += objects[i]->wssTouched;
+		mutex_unlock(&objects[i]->pageLock);
+	}
+	releaseContainerObjects(objects, count);
+	if(copy_to_user(user_stats, &stats, sizeof(stats))){
+		return -EFAULT;
+	}
+	return 0;
+}
+
+// Working-set entries are copied out to user space this many at a time.
+#define WORKING_SET_BATCH 64
+
+/**
+ * reports, for the caller's container and each of its objects up to
+ * cmd.count, the bytes used during the last complete working-set window.
+ * cmd.count is set to the number of objects in the container.
+ */
+int memory_container_working_set(struct memory_container_working_set_cmd __user *user_cmd)
+{
+	struct memory_container_working_set_cmd mcontainer;
+	struct memory_container_working_set *batch;
+	struct memory_container_working_set __user *user;
+	struct Container* container;
+	struct MemoryObject** objects;
+	unsigned long count = 0, i, j, n = 0;
+	int ret = 0;
+	if(copy_from_user(&mcontainer, user_cmd, sizeof(mcontainer))){
+		return -EFAULT;
+	}
+	user = (struct memory_container_working_set __user *)(unsigned long)mcontainer.objects;
+	batch = kmalloc_array(WORKING_SET_BATCH, sizeof(*batch), GFP_KERNEL);
+	if(batch == NULL){
+		return -ENOMEM;
+	}
+	mutex_lock(&containerMutex);
+	container = getContainerOfTask(current->pid);
+	objects = container != NULL ? grabContainerObjects(container, &count) : NULL;
+	mutex_unlock(&containerMutex);
+	if(objects == NULL){
+		kfree((void *)batch);
+		return container == NULL ? -ENOENT : -ENOMEM;
+	}
+	mcontainer.interval = READ_ONCE(wss_interval);
+	mcontainer.windows = READ_ONCE(wssWindows);
+	mcontainer.size = 0;
+	mcontainer.resident_bytes = 0;
+	mcontainer.touched_bytes = 0;
+	for(i = 0; i < count; i++){
+		struct memory_container_working_set *entry = &batch[n];
+		mutex_lock(&objects[i]->pageLock);
+		entry->oid = objects[i]->objectId;
+		entry->size = (u64)objects[i]->nrPages << PAGE_SHIFT;
+		entry->resident_bytes = 0;
+		for(j = 0; j < objects[i]->nrPages; j++){
+			if(objects[i]->pages[j] != NULL){
+				entry->resident_bytes += PAGE_SIZE;
+			}
+		}
+		entry->touched_bytes = objects[i]->wssTouched;
+		memcpy(entry->history, objects[i]->wssHistory, sizeof(entry->history));
+		mutex_unlock(&objects[i]->pageLock);
+		mcontainer.size += entry->size;
+		mcontainer.resident_bytes += entry->resident_bytes;
+		mcontainer.touched_bytes += entry->touched_bytes;
+		if(ret == 0 && i < mcontainer.count && (++n == WORKING_SET_BATCH || i + 1 == min_t(u64, count, mcontainer.count))){
+			if(copy_to_user(user + i + 1 - n, batch, n * sizeof(*batch))){
+				ret = -EFAULT;
+			}
+			n = 0;
+		}
+		cond_resched();
+	}
+	releaseContainerObjects(objects, count);
+	kfree((void *)batch);
+	mcontainer.count = count;
+	if(ret == 0 && copy_to_user(user_cmd, &mcontainer, sizeof(mcontainer))){
+		ret = -EFAULT;
+	}
+	return ret;
+}
+
+// Digests are copied in and out of user space this many entries at a time.
+#define DIGEST_BATCH 64
+
+// CRC32C of the object's nrPages pages, computed without mapping it or
+// changing what is resident: untouched pages count as zeros and compressed
+// ones are expanded into scratch.
+int digestObject(struct MemoryObject* obj, void *scratch, u32 *digest, u64 *size){
+	u32 crc = ~0U;
+	unsigned long i;
+	int ret = 0;
+	mutex_lock(&obj->pageLock);
+	for(i = 0; i < obj->nrPages; i++){
+		if(obj->pages[i] != NULL){
+			crc = crc32c(crc, kmap(obj->pages[i]), PAGE_SIZE);
+			kunmap(obj->pages[i]);
+		}else if(obj->zpages != NULL && obj->zpages[i] != NULL){
+			size_t length = obj->zpages[i]->length;
+			if(lz4_decompress(obj->zpages[i]->data, &length, scratch, PAGE_SIZE)){
+				ret = -EIO;
+				break;
+			}
+			crc = crc32c(crc, scratch, PAGE_SIZE);
+		}else{
+			crc = crc32c(crc, page_address(ZERO_PAGE(0)), PAGE_SIZE);
+		}
+	}
+	*size = (u64)obj->nrPages << PAGE_SHIFT;
+	mutex_unlock(&obj->pageLock);
+	*digest = ~crc;
+	return(ret);
+}
+
+/**
+ * fills in the CRC32C of every listed object of the caller's container
+ * without mapping any of them. Objects that do not exist get -ENOENT in
+ * their status. Hold the object locks for a digest consistent with writers.
+ */
+int memory_container_digest(struct memory_container_digest_cmd __user *user_cmd)
+{
+	struct memory_container_digest_cmd mcontainer;
+	struct memory_container_digest *batch;
+	struct memory_container_digest __user *user;
+	void *scratch;
+	u64 done, n, i;
+	int ret = 0;
+	if(copy_from_user(&mcontainer, user_cmd, sizeof(mcontainer))){
+		return -EFAULT;
+	}
+	user = (struct memory_container_digest __user *)(unsigned long)mcontainer.digests;
+	batch = kmalloc_array(DIGEST_BATCH, sizeof(*batch), GFP_KERNEL);
+	scratch = (void *)__get_free_page(GFP_KERNEL);
+	if(batch == NULL || scratch == NULL){
+		kfree((void *)batch);
+		free_page((unsigned long)scratch);
+		return -ENOMEM;
+	}
+	for(done = 0; done < mcontainer.count && ret == 0; done += n){
+		n = min_t(u64, mcontainer.count - done, DIGEST_BATCH);
+		if(copy_from_user(batch, user + done, n * sizeof(*batch))){
+			ret = -EFAULT;
+			break;
+		}
+		for(i = 0; i < n; i++){
+			struct MemoryObject* obj = grabTaskObject(batch[i].oid, NULL);
+			batch[i].size = 0;
+			batch[i].digest = 0;
+			if(obj == NULL){
+				batch[i].status = -ENOENT;
+				continue;
+			}
+			batch[i].status = digestObject(obj, scratch, &batch[i].digest, &batch[i].size);
+			putMemoryObject(obj);
+			cond_resched();
+		}
+		if(copy_to_user(user + done, batch, n * sizeof(*batch))){
+			ret = -EFAULT;
+		}else if(fatal_signal_pending(current)){
+			ret = -EINTR;
+		}
+	}
+	free_page((unsigned long)scratch);
+	kfree((void *)batch);
+	return ret;
+}
+
+
+// Imports and exports move this many pages per trip through pageLock.
+#define TRANSFER_BATCH 64
+
+// Reads from file until length bytes are in or the file ends, and returns
+// the bytes read. The file may be slow, or be this device, so it is read
+// without pageLock: into fresh pages that whole pages of the object are
+// then swapped for, or that partial pages are copied from. The object only
+// grows to what was actually read.
+long importObjectPages(struct file *file, loff_t pos, struct MemoryObject* obj, u64 offset, u64 length){
+	struct page *fresh[TRANSFER_BATCH];
+	unsigned int got[TRANSFER_BATCH];
+	u64 done = 0, base;
+	unsigned long first, k, n, batch;
+	int ret = 0, eof = 0;
+	while(done < length && !eof && ret == 0){
+		base = done;
+		first = (offset + base) >> PAGE_SHIFT;
+		batch = n = min_t(u64, DIV_ROUND_UP(offset + length, PAGE_SIZE) - first, TRANSFER_BATCH);
+		for(k = 0; k < n; k++){
+			fresh[k] = NULL;
+			got[k] = 0;
+		}
+		for(k = 0; k < n && !eof && ret == 0; k++){
+			unsigned long start = k == 0 ? (offset + base) & ~PAGE_MASK : 0;
+			unsigned long want = min_t(u64, PAGE_SIZE - start, length - done);
+			if((fresh[k] = allocObjectPage()) == NULL){
+				ret = -ENOMEM;
+				break;
+			}
+			while(got[k] < want){
+				int read = kernel_read(file, pos + done, (char *)kmap(fresh[k]) + start + got[k], want - got[k]);
+				kunmap(fresh[k]);
+				if(read <= 0){
+					ret = read;
+					eof = 1;
+					break;
+				}
+				got[k] += read;
+				done += read;
+			}
+		}
+		if(done == base){
+			n = 0;
+		}
+		lockObjectPages(obj);
+		if(n > 0 && resizeObjectPages(obj, DIV_ROUND_UP(offset + done, PAGE_SIZE))){
+			ret = -ENOMEM;
+			n = 0;
+		}
+		// whoever has the old pages mapped must fault in the new contents
+		if(n > 0 && obj->mapping != NULL){
+			unmapObjectPages(obj->mapping, obj, first, DIV_ROUND_UP(offset + done, PAGE_SIZE) - first);
+		}
+		for(k = 0; k < n && got[k] > 0; k++){
+			unsigned long start = k == 0 ? (offset + base) & ~PAGE_MASK : 0;
+			struct page *page;
+			noteObjectAccess(obj, first + k);
+			if(got[k] == PAGE_SIZE){
+				if(obj->pages[first + k] != NULL){
+					releaseObjectPage(obj->pages[first + k]);
+				}
+				dropCompressedPage(obj, first + k);
+				obj->pages[first + k] = fresh[k];
+				fresh[k] = NULL;
+				continue;
+			}
+			if((page = getObjectPage(obj, first + k, 1)) == NULL){
+				ret = -ENOMEM;
+				break;
+			}
+			memcpy((char *)kmap(page) + start, (char *)kmap(fresh[k]) + start, got[k]);
+			kunmap(fresh[k]);
+			kunmap(page);
+		}
+		obj->lastAccess = jiffies;
+		mutex_unlock(&obj->pageLock);
+		for(k = 0; k < batch; k++){
+			if(fresh[k] != NULL){
+				releaseObjectPage(fresh[k]);
+			}
+		}
+		cond_resched();
+	}
+	return(done || ret == 0 ? (long)done : ret);
+}
+
+// Writes bytes [offset, offset + length) of the object to file and returns
+// the bytes written. Pages are pinned a batch at a time under pageLock and
+// written after dropping it, so a slow file does not hold up faults.
+long exportObjectPages(struct file *file, loff_t pos, struct MemoryObject* obj, u64 offset, u64 length){
+	struct page *pinned[TRANSFER_BATCH];
+	u64 done = 0;
+	unsigned long first, k, n, loaded;
+	ssize_t written;
+	int ret = 0, stop = 0;
+	while(done < length && ret == 0 && !stop){
+		first = (offset + done) >> PAGE_SHIFT;
+		n = min_t(u64, DIV_ROUND_UP(offset + length, PAGE_SIZE) - first, TRANSFER_BATCH);
+		lockObjectPages(obj);
+		obj->lastAccess = jiffies;
+		for(loaded = 0; loaded < n; loaded++){
+			pinned[loaded] = NULL;
+			// past the end when the object shrank meanwhile, reads as zeroes
+			if(first + loaded >= obj->nrPages){
+				continue;
+			}
+			if((ret = loadObjectPage(obj, first + loaded))){
+				break;
+			}
+			noteObjectAccess(obj, first + loaded);
+			if((pinned[loaded] = obj->pages[first + loaded]) != NULL){
+				get_page(pinned[loaded]);
+			}
+		}
+		mutex_unlock(&obj->pageLock);
+		for(k = 0; k < loaded; k++){
+			unsigned long start = (offset + done) & ~PAGE_MASK;
+			unsigned long count = min_t(u64, PAGE_SIZE - start, length - done);
+			if(!stop){
+				if(pinned[k] == NULL){
+					// never touched, reads back as zeroes
+					written = kernel_write(file, (char *)page_address(ZERO_PAGE(0)) + start, count, pos + done);
+				}else{
+					written = kernel_write(file, (char *)kmap(pinned[k]) + start, count, pos + done);
+					kunmap(pinned[k]);
+				}
+				if(written > 0){
+					done += written;
+				}
+				if(written < (ssize_t)count){
+					stop = 1;
+					if(written < 0 && done == 0){
+						ret = written;
+					}
+				}
+			}
+			if(pinned[k] != NULL){
+				put_page(pinned[k]);
+			}
+		}
+		cond_resched();
+	}
+	return(done ? (long)done : ret);
+}
+
+/**
+ * copies cmd.length bytes of cmd.fd at cmd.file_offset into object cmd.oid
+ * at cmd.object_offset with no user-space buffer in between, creating and
+ * growing the object as far as data arrives. cmd.length is set to the
+ * bytes copied, which is short only when the file ended. Ranges that wrap
+ * or end past the largest object fail with -EINVAL.
+ */
+int memory_container_import(struct memory_container_transfer_cmd __user *user_cmd)
+{
+	struct memory_container_transfer_cmd mcontainer;
+	struct MemoryObject* obj;
+	struct file *file;
+	long done;
+	if(copy_from_user(&mcontainer, user_cmd, sizeof(struct memory_container_transfer_cmd))){
+		return -EFAULT;
+	}
+	// the object may not wrap or outgrow what positioned I/O can address
+	if(mcontainer.object_offset + mcontainer.length < mcontainer.object_offset || mcontainer.object_offset + mcontainer.length > MCONTAINER_POS_MASK + 1){
+		return -EINVAL;
+	}
+	file = fget(mcontainer.fd);
+	if(file == NULL || !(file->f_mode & FMODE_READ)){
+		if(file != NULL){
+			fput(file);
+		}
+		return -EBADF;
+	}
+	obj = grabWritableTaskObject(mcontainer.oid);
+	if(IS_ERR(obj)){
+		fput(file);
+		return PTR_ERR(obj);
+	}
+	done = importObjectPages(file, mcontainer.file_offset, obj, mcontainer.object_offset, mcontainer.length);
+	if(done > 0){
+		noteObjectWrite(obj);
+	}
+	putMemoryObject(obj);
+	fput(file);
+	if(done < 0){
+		return done;
+	}
+	mcontainer.length = done;
+	if(copy_to_user(user_cmd, &mcontainer, sizeof(struct memory_container_transfer_cmd))){
+		return -EFAULT;
+	}
+	return 0;
+}
+
+/**
+ * copies cmd.length bytes of object cmd.oid at cmd.object_offset to cmd.fd
+ * at cmd.file_offset, which may also be a pipe or socket, with no user-space
+ * buffer in between. The range is cut at the end of the object and
+ * cmd.length is set to the bytes copied; a range that wraps fails with
+ * -EINVAL.
+ */
+int memory_container_export(struct memory_container_transfer_cmd __user *user_cmd)
+{
+	struct memory_container_transfer_cmd mcontainer;
+	struct MemoryObject* obj;
+	struct file *file;
+	u64 size, length;
+	long done;
+	if(copy_from_user(&mcontainer, user_cmd, sizeof(struct memory_container_transfer_cmd))){
+		return -EFAULT;
+	}
+	if(mcontainer.object_offset + mcontainer.length < mcontainer.object_offset){
+		return -EINVAL;
+	}
+	file = fget(mcontainer.fd);
+	if(file == NULL || !(file->f_mode & FMODE_WRITE)){
+		if(file != NULL){
+			fput(file);
+		}
+		return -EBADF;
+	}
+	obj = grabTaskObject(mcontainer.oid, NULL);
+	if(obj == NULL){
+		fput(file);
+		return -ENOENT;
+	}
+	lockObjectPages(obj);
+	size = (u64)obj->nrPages << PAGE_SHIFT;
+	mutex_unlock(&obj->pageLock);
+	length = mcontainer.object_offset < size ? min(mcontainer.length, size - mcontainer.object_offset) : 0;
+	done = exportObjectPages(file, mcontainer.file_offset, obj, mcontainer.object_offset, length);
+	putMemoryObject(obj);
+	fput(file);
+	if(done < 0){
+		return done;
+	}
+	mcontainer.length = done;
+	if(copy_to_user(user_cmd, &mcontainer, sizeof(struct memory_container_transfer_cmd))){
+		return -EFAULT;
+	}
+	return 0;
+}
+
+
+// Object reads and writes bounce through a kernel page: user memory may
+// itself be a mapping of the object, and faulting it in while holding
+// obj->pageLock would deadlock against our own fault handler.
+
+// Copies up to the end of the object into iter and returns the bytes read.
+ssize_t readObjectIter(struct MemoryObject* obj, u64 offset, struct iov_iter *iter, char *bounce){
+	size_t done = 0;
+	ssize_t ret = 0;
+	while(iov_iter_count(iter) > 0){
+		unsigned long index = offset >> PAGE_SHIFT;
+		size_t start = offset & ~PAGE_MASK;
+		size_t n = min_t(size_t, PAGE_SIZE - start, iov_iter_count(iter));
+		struct page *page;
+		lockObjectPages(obj);
+		if(index >= obj->nrPages){
+			mutex_unlock(&obj->pageLock);
+			break;
+		}
+		obj->lastAccess = jiffies;
+		noteObjectAccess(obj, index);
+		if((ret = loadObjectPage(obj, index))){
+			mutex_unlock(&obj->pageLock);
+			break;
+		}
+		page = obj->pages[index];
+		if(page == NULL){
+			memset(bounce, 0, n);
+		}else{
+			memcpy(bounce, (char *)kmap(page) + start, n);
+			kunmap(page);
+		}
+		mutex_unlock(&obj->pageLock);
+		if(copy_to_iter(bounce, n, iter) != n){
+			ret = -EFAULT;
+			break;
+		}
+		done += n;
+		offset += n;
+	}
+	return(done ? (ssize_t)done : ret);
+}
+
+// Copies iter into the object, growing it as needed, and returns the bytes
+// written. Mappings of pages that had to be unshared are zapped.
+ssize_t writeObjectIter(struct file *filp, struct MemoryObject* obj, u64 offset, struct iov_iter *iter, char *bounce){
+	unsigned long first = offset >> PAGE_SHIFT;
+	size_t done = 0;
+	ssize_t ret = 0;
+	int replaced = 0;
+	while(iov_iter_count(iter) > 0){
+		unsigned long index = offset >> PAGE_SHIFT;
+		size_t start = offset & ~PAGE_MASK;
+		size_t n = min_t(size_t, PAGE_SIZE - start, iov_iter_count(iter));
+		struct page *page = NULL, *old = NULL;
+		if(copy_from_iter(bounce, n, iter) != n){
+			ret = -EFAULT;
+			break;
+		}
+		lockObjectPages(obj);
+		if((ret = resizeObjectPages(obj, index + 1)) == 0){
+			old = obj->pages[index];
+			page = getObjectPage(obj, index, 1);
+		}
+		if(page != NULL){
+			memcpy((char *)kmap(page) + start, bounce, n);
+			kunmap(page);
+			obj->lastAccess = jiffies;
+			noteObjectAccess(obj, index);
+			replaced |= old != NULL && old != page;
+		}
+		mutex_unlock(&obj->pageLock);
+		if(page == NULL){
+			ret = ret ? ret : -ENOMEM;
+			break;
+		}
+		done += n;
+		offset += n;
+	}
+	if(replaced){
+		unmapObjectPages(filp->f_mapping, obj, first, DIV_ROUND_UP(offset, PAGE_SIZE) - first);
+	}
+	if(done){
+		noteObjectWrite(obj);
+	}
+	return(done ? (ssize_t)done : ret);
+}
+
+/**
+ * pread()/readv() on the device: reads object ki_pos >> 32 from byte
+ * ki_pos & 0xffffffff. Reads stop at the end of the object.
+ */
+ssize_t memory_container_read_iter(struct kiocb *iocb, struct iov_iter *to)
+{
+	u64 offset = iocb->ki_pos & MCONTAINER_POS_MASK;
+	struct MemoryObject* obj;
+	char *bounce;
+	ssize_t ret;
+	obj = grabTaskObject(iocb->ki_pos >> MCONTAINER_POS_SHIFT, NULL);
+	if(obj == NULL){
+		return -ENOENT;
+	}
+	bounce = (char *)__get_free_page(GFP_KERNEL);
+	if(bounce == NULL){
+		putMemoryObject(obj);
+		return -ENOMEM;
+	}
+	iov_iter_truncate(to, MCONTAINER_POS_MASK + 1 - offset);
+	ret = readObjectIter(obj, offset, to, bounce);
+	if(ret > 0){
+		iocb->ki_pos += ret;
+	}
+	free_page((unsigned long)bounce);
+	putMemoryObject(obj);
+	return ret;
+}
+
+/**
+ * pwrite()/writev() on the device: writes object ki_pos >> 32 at byte
+ * ki_pos & 0xffffffff, creating and growing it like mmap would.
+ */
+ssize_t memory_container_write_iter(struct kiocb *iocb, struct iov_iter *from)
+{
+	u64 offset = iocb->ki_pos & MCONTAINER_POS_MASK;
+	struct MemoryObject* obj;
+	char *bounce;
+	ssize_t ret;
+	obj = grabWritableTaskObject(iocb->ki_pos >> MCONTAINER_POS_SHIFT);
+	if(IS_ERR(obj)){
+		return PTR_ERR(obj);
+	}
+	bounce = (char *)__get_free_page(GFP_KERNEL);
+	if(bounce == NULL){
+		putMemoryObject(obj);
+		return -ENOMEM;
+	}
+	iov_iter_truncate(from, MCONTAINER_POS_MASK + 1 - offset);
+	ret = writeObjectIter(iocb->ki_filp, obj, offset, from, bounce);
+	if(ret > 0){
+		iocb->ki_pos += ret;
+	}
+	free_page((unsigned long)bounce);
+	putMemoryObject(obj);
+	return ret;
+}
+
+// Batched reads and writes are copied in and out this many at a time.
+#define IO_BATCH 64
+
+/**
+ * reads or writes every piece of cmd.ios, each naming its own object,
+ * offset and user buffer, in a single call. Every piece gets its own
+ * result; the call itself only fails when the array cannot be accessed.
+ */
+int memory_container_io_batch(struct file *filp, struct memory_container_io_cmd __user *user_cmd, int write)
+{
+	struct memory_container_io_cmd mcontainer;
+	struct memory_container_io *batch;
+	struct memory_container_io __user *user;
+	char *bounce;
+	u64 done, n, i;
+	int ret = 0;
+	if(copy_from_user(&mcontainer, user_cmd, sizeof(mcontainer))){
+		return -EFAULT;
+	}
+	user = (struct memory_container_io __user *)(unsigned long)mcontainer.ios;
+	batch = kmalloc_array(IO_BATCH, sizeof(*batch), GFP_KERNEL);
+	bounce = (char *)__get_free_page(GFP_KERNEL);
+	if(batch == NULL || bounce == NULL){
+		kfree((void *)batch);
+		free_page((unsigned long)bounce);
+		return -ENOMEM;
+	}
+	for(done = 0; done < mcontainer.count && ret == 0; done += n){
+		n = min_t(u64, mcontainer.count - done, IO_BATCH);
+		if(copy_from_user(batch, user + done, n * sizeof(*batch))){
+			ret = -EFAULT;
+			break;
+		}
+		for(i = 0; i < n; i++){
+			struct MemoryObject* obj;
+			struct iovec iov;
+			struct iov_iter iter;
+			if(batch[i].offset > MCONTAINER_POS_MASK){
+				batch[i].result = -EINVAL;
+				continue;
+			}
+			if((batch[i].result = import_single_range(write ? WRITE : READ, (void __user *)(unsigned long)batch[i].buf, batch[i].length, &iov, &iter))){
+				continue;
+			}
+			iov_iter_truncate(&iter, MCONTAINER_POS_MASK + 1 - batch[i].offset);
+			obj = write ? grabWritableTaskObject(batch[i].oid) : grabTaskObject(batch[i].oid, NULL);
+			if(IS_ERR_OR_NULL(obj)){
+				batch[i].result = obj == NULL ? -ENOENT : PTR_ERR(obj);
+				continue;
+			}
+			if(write){
+				batch[i].result = writeObjectIter(filp, obj, batch[i].offset, &iter, bounce);
+			}else{
+				batch[i].result = readObjectIter(obj, batch[i].offset, &iter, bounce);
+			}
+			putMemoryObject(obj);
+		}
+		if(copy_to_user(user + done, batch, n * sizeof(*batch))){
+			ret = -EFAULT;
+		}else if(fatal_signal_pending(current)){
+			ret = -EINTR;
+		}
+	}
+	free_page((unsigned long)bounce);
+	kfree((void *)batch);
+	return ret;
+}
+
+
+/**
+ * publishes a change to an object written through a mapping without the
+ * object lock, waking everyone waiting on or polling it.
+ */
+int memory_container_publish(struct memory_container_cmd __user *user_cmd)
+{
+	struct memory_container_cmd mcontainer;
+	struct MemoryObject* obj;
+	if(copy_from_user(&mcontainer, user_cmd, sizeof(struct memory_container_cmd))){
+		return -EFAULT;
+	}
+	obj = grabTaskObject(mcontainer.oid, NULL);
+	if(obj == NULL){
+		return -ENOENT;
+	}
+	publishObjectChange(obj);
+	armObjectWatch(obj);
+	putMemoryObject(obj);
+	return 0;
+}
+
+/**
+ * sleeps until the generation of an object moves past cmd.generation or
+ * cmd.timeout_ms (0 waits for ever) runs out, and returns the generation
+ * it found in cmd.generation.
+ */
+int memory_container_wait(struct memory_container_wait_cmd __user *user_cmd)
+{
+	struct memory_container_wait_cmd mcontainer;
+	struct MemoryObject* obj;
+	long timeout, ret;
+	if(copy_from_user(&mcontainer, user_cmd, sizeof(struct memory_container_wait_cmd))){
+		return -EFAULT;
+	}
+	obj = grabTaskObject(mcontainer.oid, NULL);
+	if(obj == NULL){
+		return -ENOENT;
+	}
+	timeout = mcontainer.timeout_ms ? (long)msecs_to_jiffies(mcontainer.timeout_ms) : MAX_SCHEDULE_TIMEOUT;
+	atomic_inc(&obj->watchers);
+	armObjectWatch(obj);
+	ret = wait_event_interruptible_timeout(changeWait, (u64)atomic64_read(&obj->generation) != mcontainer.generation, timeout);
+	atomic_dec(&obj->watchers);
+	mcontainer.generation = atomic64_read(&obj->generation);
+	putMemoryObject(obj);
+	if(ret < 0){
+		return ret;
+	}
+	if(ret == 0){
+		return -ETIMEDOUT;
+	}
+	if(copy_to_user(user_cmd, &mcontainer, sizeof(struct memory_container_wait_cmd))){
+		return -EFAULT;
+	}
+	return 0;
+}
+
+/**
+ * adds an object to the watch set of this fd (or acknowledges what was seen
+ * of it so far), or removes it with MCONTAINER_WATCH_REMOVE. poll() on the
+ * fd is readable while any watched object changed since acknowledged.
+ */
+int memory_container_watch(struct file *filp, struct memory_container_watch_cmd __user *user_cmd)
+{
+	struct memory_container_watch_cmd mcontainer;
+	struct WatchSet* set = READ_ONCE(filp->private_data);
+	struct Watch** link;
+	struct Watch* watch;
+	struct MemoryObject* obj;
+	int ret = 0;
+	if(copy_from_user(&mcontainer, user_cmd, sizeof(struct memory_container_watch_cmd))){
+		return -EFAULT;
+	}
+	if(set == NULL){
+		struct WatchSet* fresh = kmalloc(sizeof(struct WatchSet), GFP_KERNEL);
+		if(fresh == NULL){
+			return -ENOMEM;
+		}
+		mutex_init(&fresh->lock);
+		fresh->head = NULL;
+		set = cmpxchg(&filp->private_data, NULL, fresh);
+		if(set != NULL){
+			kfree((void *)fresh);
+		}else{
+			set = fresh;
+		}
+	}
+	obj = grabTaskObject(mcontainer.oid, NULL);
+	mutex_lock(&set->lock);
+	for(link = &set->head; *link != NULL; link = &(*link)->next){
+		if((*link)->obj->objectId == mcontainer.oid){
+			break;
+		}
+	}
+	watch = *link;
+	if(mcontainer.flags == MCONTAINER_WATCH_REMOVE){
+		if(watch != NULL){
+			*link = watch->next;
+			atomic_dec(&watch->obj->watchers);
+			putMemoryObject(watch->obj);
+			kfree((void *)watch);
+		}else{
+			ret = -ENOENT;
+		}
+	}else if(watch != NULL){
+		if(obj != NULL && obj != watch->obj){
+			// the object was freed and allocated again, follow the new one
+			struct MemoryObject* old = watch->obj;
+			atomic_dec(&old->watchers);
+			putMemoryObject(old);
+			watch->obj = obj;
+			obj = NULL;
+			atomic_inc(&watch->obj->watchers);
+			armObjectWatch(watch->obj);
+		}
+		watch->generation = atomic64_read(&watch->obj->generation);
+		mcontainer.generation = watch->generation;
+	}else if(obj == NULL){
+		ret = -ENOENT;
+	}else if((watch = kmalloc(sizeof(struct Watch), GFP_KERNEL)) == NULL){
+		ret = -ENOMEM;
+	}else{
+		// the watch keeps our reference
+		watch->obj = obj;
+		obj = NULL;
+		atomic_inc(&watch->obj->watchers);
+		armObjectWatch(watch->obj);
+		watch->generation = atomic64_read(&watch->obj->generation);
+		watch->next = set->head;
+		set->head = watch;
+		mcontainer.generation = watch->generation;
+	}
+	mutex_unlock(&set->lock);
+	if(obj != NULL){
+		putMemoryObject(obj);
+	}
+	if(ret == 0 && copy_to_user(user_cmd, &mcontainer, sizeof(struct memory_container_watch_cmd))){
+		ret = -EFAULT;
+	}
+	return ret;
+}
+
+/**
+ * readable while an object watched through this fd has a change that was
+ * not acknowledged yet.
+ */
+unsigned int memory_container_poll(struct file *filp, poll_table *wait)
+{
+	struct WatchSet* set = READ_ONCE(filp->private_data);
+	struct Watch* watch;
+	unsigned int mask = 0;
+	poll_wait(filp, &changeWait, wait);
+	// queued before reading generations, see publishObjectChange()
+	smp_mb();
+	if(set == NULL){
+		return 0;
+	}
+	mutex_lock(&set->lock);
+	for(watch = set->head; watch != NULL; watch = watch->next){
+		if((u64)atomic64_read(&watch->obj->generation) != watch->generation){
+			mask |= POLLIN | POLLRDNORM;
+			break;
+		}
+	}
+	mutex_unlock(&set->lock);
+	return mask;
+}
+
+
+// Checkpoints go through a staging buffer so the file sees a few large
+// sequential requests rather than one per page.
+#define CHECKPOINT_CHUNK (1 << 20)
+#define CHECKPOINT_BATCH (CHECKPOINT_CHUNK >> PAGE_SHIFT)
+
+struct CheckpointStream{
+	struct file *file;
+	loff_t pos;
+	char *buffer;
+	size_t used;
+	size_t filled;
+};
+
+int flushCheckpointStream(struct CheckpointStream* stream){
+	size_t done = 0;
+	while(done < stream->used){
+		ssize_t n = kernel_write(stream->file, stream->buffer + done, stream->used - done, stream->pos);
+		if(n <= 0){
+			return(n < 0 ? (int)n : -EIO);
+		}
+		done += n;
+		stream->pos += n;
+	}
+	stream->used = 0;
+	return(0);
+}
+
+int writeCheckpointStream(struct CheckpointStream* stream, const void *data, size_t len){
+	int ret;
+	while(len > 0){
+		size_t n = min_t(size_t, len, CHECKPOINT_CHUNK - stream->used);
+		if(data != NULL){
+			memcpy(stream->buffer + stream->used, data, n);
+			data = (const char *)data + n;
+		}else{
+			memset(stream->buffer + stream->used, 0, n);
+		}
+		stream->used += n;
+		len -= n;
+		if(stream->used == CHECKPOINT_CHUNK && (ret = flushCheckpointStream(stream))){
+			return(ret);
+		}
+	}
+	return(0);
+}
+
+int readCheckpointStream(struct CheckpointStream* stream, void *data, size_t len){
+	while(len > 0){
+		size_t n;
+		if(stream->used == stream->filled){
+			int got = kernel_read(stream->file, stream->pos, stream->buffer, CHECKPOINT_CHUNK);
+			if(got <= 0){
+				return(got < 0 ? got : -EIO);
+			}
+			stream->pos += got;
+			stream->used = 0;
+			stream->filled = got;
+		}
+		n = min_t(size_t, len, stream->filled - stream->used);
+		memcpy(data, stream->buffer + stream->used, n);
+		stream->used += n;
+		data = (char *)data + n;
+		len -= n;
+	}
+	return(0);
+}
+
+int openCheckpointStream(struct CheckpointStream* stream, struct memory_container_checkpoint_cmd* cmd, fmode_t mode){
+	stream->file = fget(cmd->fd);
+	if(stream->file == NULL){
+		return(-EBADF);
+	}
+	if(!(stream->file->f_mode & mode)){
+		fput(stream->file);
+		return(-EBADF);
+	}
+	stream->buffer = vmalloc(CHECKPOINT_CHUNK);
+	if(stream->buffer == NULL){
+		fput(stream->file);
+		return(-ENOMEM);
+	}
+	stream->pos = cmd->offset;
+	stream->used = 0;
+	stream->filled = 0;
+	return(0);
+}
+
+void closeCheckpointStream(struct CheckpointStream* stream){
+	vfree(stream->buffer);
+	fput(stream->file);
+}
+
+/**
+ * streams every object of the caller's container (id, size and contents) to
+ * cmd.fd starting at cmd.offset and reports the bytes written in cmd.size.
+ * Pages are taken a batch at a time and written without holding the object,
+ * so for a consistent image checkpoint a snapshot of the container rather
+ * than the live one.
+ */
+int memory_container_checkpoint(struct memory_container_checkpoint_cmd __user *user_cmd)
+{
+	struct memory_container_checkpoint_cmd mcontainer;
+	struct memory_container_checkpoint_header header;
+	struct memory_container_checkpoint_object record;
+	struct CheckpointStream stream;
+	struct Container* container;
+	struct MemoryObject** objects;
+	struct page **batch;
+	unsigned long count = 0, nrPages, i, j, k, n;
+	int ret;
+	if(copy_from_user(&mcontainer, user_cmd, sizeof(struct memory_container_checkpoint_cmd))){
+		return -EFAULT;
+	}
+	batch = kcalloc(CHECKPOINT_BATCH, sizeof(struct page *), GFP_KERNEL);
+	if(batch == NULL){
+		return -ENOMEM;
+	}
+	if((ret = openCheckpointStream(&stream, &mcontainer, FMODE_WRITE))){
+		kfree((void *)batch);
+		return ret;
+	}
+	mutex_lock(&containerMutex);
+	container = getContainerOfTask(current->pid);
+	objects = container != NULL ? grabContainerObjects(container, &count) : NULL;
 	mutex_unlock(&containerMutex);
-	//printk("before return of container free\n");
+	if(objects == NULL){
+		closeCheckpointStream(&stream);
+		kfree((void *)batch);
+		return container == NULL ? -ENOENT : -ENOMEM;
+	}
+	header.magic = MCONTAINER_CHECKPOINT_MAGIC;
+	header.version = MCONTAINER_CHECKPOINT_VERSION;
+	header.objects = count;
+	ret = writeCheckpointStream(&stream, &header, sizeof(header));
+	for(i = 0; ret == 0 && i < count; i++){
+		nrPages = READ_ONCE(objects[i]->nrPages);
+		record.oid = objects[i]->objectId;
+		record.size = (__u64)nrPages << PAGE_SHIFT;
+		ret = writeCheckpointStream(&stream, &record, sizeof(record));
+		for(j = 0; ret == 0 && j < nrPages; j += n){
+			// hold references to a batch of pages so the writes, which may
+			// block on the file, happen without the page lock
+			n = min_t(unsigned long, nrPages - j, CHECKPOINT_BATCH);
+			lockObjectPages(objects[i]);
+			for(k = 0; k < n; k++){
+				batch[k] = NULL;
+				// past the end when a restore shrank the object since the
+				// record was written
+				if(ret || j + k >= objects[i]->nrPages){
+					continue;
+				}
+				if((ret = loadObjectPage(objects[i], j + k)) == 0 && (batch[k] = objects[i]->pages[j + k]) != NULL){
+					get_page(batch[k]);
+				}
+			}
+			mutex_unlock(&objects[i]->pageLock);
+			for(k = 0; k < n; k++){
+				if(batch[k] == NULL){
+					// never touched, reads back as zeroes
+					ret = ret ? ret : writeCheckpointStream(&stream, NULL, PAGE_SIZE);
+					continue;
+				}
+				if(ret == 0){
+					ret = writeCheckpointStream(&stream, kmap(batch[k]), PAGE_SIZE);
+					kunmap(batch[k]);
+				}
+				put_page(batch[k]);
+			}
+		}
+	}
+	if(ret == 0){
+		ret = flushCheckpointStream(&stream);
+	}
+	releaseContainerObjects(objects, count);
+	if(ret == 0){
+		mcontainer.size = stream.pos - mcontainer.offset;
+		if(copy_to_user(user_cmd, &mcontainer, sizeof(struct memory_container_checkpoint_cmd))){
+			ret = -EFAULT;
+		}
+	}
+	closeCheckpointStream(&stream);
+	kfree((void *)batch);
+	return ret;
+}
+
+
+// Fills one object from the stream, dropping all-zero pages so that sparse
+// objects stay sparse, and drops whatever the object had past the
+// checkpointed size. Called with obj->pageLock held.
+int restoreObjectPages(struct CheckpointStream* stream, struct MemoryObject* obj, unsigned long nrPages){
+	unsigned long j;
+	int ret = resizeObjectPages(obj, nrPages);
+	for(j = 0; ret == 0 && j < nrPages; j++){
+		struct page *page = allocObjectPage();
+		void *addr;
+		if(page == NULL){
+			return(-ENOMEM);
+		}
+		addr = kmap(page);
+		ret = readCheckpointStream(stream, addr, PAGE_SIZE);
+		if(ret == 0 && memchr_inv(addr, 0, PAGE_SIZE) == NULL){
+			kunmap(page);
+			releaseObjectPage(page);
+			page = NULL;
+		}else{
+			kunmap(page);
+		}
+		if(ret){
+			releaseObjectPage(page);
+			break;
+		}
+		if(obj->pages[j] != NULL){
+			releaseObjectPage(obj->pages[j]);
+		}
+		dropCompressedPage(obj, j);
+		obj->pages[j] = page;
+	}
+	for(j = nrPages; ret == 0 && j < obj->nrPages; j++){
+		if(obj->pages[j] != NULL){
+			releaseObjectPage(obj->pages[j]);
+			obj->pages[j] = NULL;
+		}
+		dropCompressedPage(obj, j);
+	}
+	if(ret == 0){
+		obj->nrPages = nrPages;
+	}
+	return(ret);
+}
+
+/**
+ * rebuilds the caller's container from a checkpoint read sequentially from
+ * cmd.fd at cmd.offset. Objects in the checkpoint replace existing objects
+ * with the same id; cmd.size returns the bytes consumed.
+ */
+int memory_container_restore(struct file *filp, struct memory_container_checkpoint_cmd __user *user_cmd)
+{
+	struct memory_container_checkpoint_cmd mcontainer;
+	struct memory_container_checkpoint_header header;
+	struct memory_container_checkpoint_object record;
+	struct CheckpointStream stream;
+	struct Container* container;
+	struct MemoryObject* obj;
+	unsigned long i, oldPages;
+	int ret;
+	if(copy_from_user(&mcontainer, user_cmd, sizeof(struct memory_container_checkpoint_cmd))){
+		return -EFAULT;
+	}
+	if((ret = openCheckpointStream(&stream, &mcontainer, FMODE_READ))){
+		return ret;
+	}
+	ret = readCheckpointStream(&stream, &header, sizeof(header));
+	if(ret == 0 && (header.magic != MCONTAINER_CHECKPOINT_MAGIC || header.version != MCONTAINER_CHECKPOINT_VERSION)){
+		ret = -EINVAL;
+	}
+	for(i = 0; ret == 0 && i < header.objects; i++){
+		if((ret = readCheckpointStream(&stream, &record, sizeof(record)))){
+			break;
+		}
+		if(record.size & ~PAGE_MASK){
+			ret = -EINVAL;
+			break;
+		}
+		mutex_lock(&containerMutex);
+		container = getContainerOfTask(current->pid);
+		if(container == NULL || container->readOnly){
+			mutex_unlock(&containerMutex);
+			ret = container == NULL ? -ENOENT : -EROFS;
+			break;
+		}
+		obj = getContainerMemoryObject(container, record.oid);
+		if(obj == NULL){
+			obj = createMemoryObject(record.oid);
+			addMemoryToContainer(container, obj);
+		}
+		atomic_inc(&obj->refCount);
+		mutex_unlock(&containerMutex);
+		lockObjectPages(obj);
+		oldPages = obj->nrPages;
+		ret = restoreObjectPages(&stream, obj, record.size >> PAGE_SHIFT);
+		mutex_unlock(&obj->pageLock);
+		// existing mappings may still point at the replaced or dropped pages
+		unmapObjectPages(filp->f_mapping, obj, 0, max_t(unsigned long, oldPages, record.size >> PAGE_SHIFT));
+		noteObjectWrite(obj);
+		putMemoryObject(obj);
+	}
+	if(ret == 0){
+		// bytes consumed, not bytes read ahead into the staging buffer
+		mcontainer.size = stream.pos - (stream.filled - stream.used) - mcontainer.offset;
+		if(copy_to_user(user_cmd, &mcontainer, sizeof(struct memory_container_checkpoint_cmd))){
+			ret = -EFAULT;
+		}
+	}
+	closeCheckpointStream(&stream);
+	return ret;
+}
+
+
+/**
+ * called on every close() of the device, including the implicit ones at exit.
+ * Closing a duplicate leaves membership alone; only tasks that are exiting,
+ * the caller at exit included, leave their containers here.
+ */
+int memory_container_flush(struct file *filp, fl_owner_t id)
+{
+	mutex_lock(&containerMutex);
+	removeTasks(NULL, NULL);
+	mutex_unlock(&containerMutex);
+	return 0;
+}
+
+
+/**
+ * called on open(). misc_open() leaves the miscdevice in private_data,
+ * which is where the watch set of the fd lives.
+ */
+int memory_container_open(struct inode *inode, struct file *filp)
+{
+	filp->private_data = NULL;
+	return 0;
+}
+
+
+/**
+ * called when the last reference to the device file goes away.
+ */
+int memory_container_release(struct inode *inode, struct file *filp)
+{
+	struct WatchSet* set = filp->private_data;
+	mutex_lock(&containerMutex);
+	removeTasks(filp, NULL);
+	mutex_unlock(&containerMutex);
+	while(set != NULL && set->head != NULL){
+		struct Watch* watch = set->head;
+		set->head = watch->next;
+		atomic_dec(&watch->obj->watchers);
+		putMemoryObject(watch->obj);
+		kfree((void *)watch);
+	}
+	kfree((void *)set);
 	return 0;
 }
 
@@ -424,7 +3540,9 @@ int memory_container_ioctl(struct file *filp, unsigned int cmd,
     switch (cmd)
     {
     case MCONTAINER_IOCTL_CREATE:
-        return memory_container_create((void __user *)arg);
+        return memory_container_create(filp, (void __user *)arg);
+    case MCONTAINER_IOCTL_CREATE_POOLED:
+        return memory_container_create_pooled(filp, (void __user *)arg);
     case MCONTAINER_IOCTL_DELETE:
         return memory_container_delete((void __user *)arg);
     case MCONTAINER_IOCTL_LOCK:
@@ -433,6 +3551,40 @@ int memory_container_ioctl(struct file *filp, unsigned int cmd,
         return memory_container_unlock((void __user *)arg);
     case MCONTAINER_IOCTL_FREE:
         return memory_container_free((void __user *)arg);
+    case MCONTAINER_IOCTL_SNAPSHOT:
+        return memory_container_snapshot(filp, (void __user *)arg);
+    case MCONTAINER_IOCTL_CHECKPOINT:
+        return memory_container_checkpoint((void __user *)arg);
+    case MCONTAINER_IOCTL_RESTORE:
+        return memory_container_restore(filp, (void __user *)arg);
+    case MCONTAINER_IOCTL_MARK_READONLY:
+        return memory_container_mark_readonly(filp, (void __user *)arg);
+    case MCONTAINER_IOCTL_STATS:
+        return memory_container_get_stats((void __user *)arg);
+    case MCONTAINER_IOCTL_ADVISE:
+        return memory_container_advise(filp, (void __user *)arg);
+    case MCONTAINER_IOCTL_LOCK_SET:
+        return memory_container_lock_set((void __user *)arg);
+    case MCONTAINER_IOCTL_UNLOCK_SET:
+        return memory_container_unlock_set((void __user *)arg);
+    case MCONTAINER_IOCTL_DIGEST:
+        return memory_container_digest((void __user *)arg);
+    case MCONTAINER_IOCTL_IMPORT:
+        return memory_container_import((void __user *)arg);
+    case MCONTAINER_IOCTL_EXPORT:
+        return memory_container_export((void __user *)arg);
+    case MCONTAINER_IOCTL_READ_BATCH:
+        return memory_container_io_batch(filp, (void __user *)arg, 0);
+    case MCONTAINER_IOCTL_WRITE_BATCH:
+        return memory_container_io_batch(filp, (void __user *)arg, 1);
+    case MCONTAINER_IOCTL_PUBLISH:
+        return memory_container_publish((void __user *)arg);
+    case MCONTAINER_IOCTL_WAIT:
+        return memory_container_wait((void __user *)arg);
+    case MCONTAINER_IOCTL_WATCH:
+        return memory_container_watch(filp, (void __user *)arg);
+    case MCONTAINER_IOCTL_WORKING_SET:
+        return memory_container_working_set((void __user *)arg);
     default:
         return -ENOTTY;
     }
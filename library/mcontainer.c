@@ -31,6 +31,13 @@
 
 #include "mcontainer.h"
 
+#include <errno.h>
+
+// Call recording hooks, see mcontainer_record.c
+__u64 mcontainer_record_clock(void);
+void mcontainer_record_call(__u64 start, int op, __u64 oid, __u64 size, __u64 arg, __u64 arg2, long result);
+void mcontainer_record_list(__u64 start, int op, __u64 arg, long result, const void *items, size_t stride, int count);
+
 /**
  * delete function in user space that sends command to kernel space
  * for deleting the current task in specified container.
@@ -38,7 +45,10 @@
 int mcontainer_delete(int devfd)
 {
     struct memory_container_cmd cmd;
-    return ioctl(devfd, MCONTAINER_IOCTL_DELETE, &cmd);
+    __u64 start = mcontainer_record_clock();
+    int ret = ioctl(devfd, MCONTAINER_IOCTL_DELETE, &cmd);
+    mcontainer_record_call(start, MCONTAINER_REC_DELETE, 0, 0, 0, 0, ret);
+    return ret;
 }
 
 /**
@@ -48,8 +58,28 @@ int mcontainer_delete(int devfd)
 int mcontainer_create(int devfd, int cid)
 {
     struct memory_container_cmd cmd;
+    __u64 start = mcontainer_record_clock();
+    int ret;
+    cmd.cid = cid;
+    ret = ioctl(devfd, MCONTAINER_IOCTL_CREATE, &cmd);
+    mcontainer_record_call(start, MCONTAINER_REC_CREATE, cid, 0, 0, 0, ret);
+    return ret;
+}
+
+/**
+ * Like mcontainer_create(), and have the kernel keep about pages pre-zeroed
+ * pages ready for the container so first touches of its objects are cheap.
+ */
+int mcontainer_create_pooled(int devfd, int cid, __u64 pages)
+{
+    struct memory_container_pool_cmd cmd;
+    __u64 start = mcontainer_record_clock();
+    int ret;
     cmd.cid = cid;
-    return ioctl(devfd, MCONTAINER_IOCTL_CREATE, &cmd);
+    cmd.pages = pages;
+    ret = ioctl(devfd, MCONTAINER_IOCTL_CREATE_POOLED, &cmd);
+    mcontainer_record_call(start, MCONTAINER_REC_CREATE, cid, 0, pages, 0, ret);
+    return ret;
 }
 
 /**
@@ -58,7 +88,10 @@ int mcontainer_create(int devfd, int cid)
 void *mcontainer_alloc(int devfd, __u64 offset, __u64 size)
 {
     __u64 aligned_size = ((size + getpagesize() - 1) / getpagesize()) * getpagesize();
-    return mmap(0, aligned_size, PROT_READ | PROT_WRITE, MAP_SHARED, devfd, offset * getpagesize());
+    __u64 start = mcontainer_record_clock();
+    void *data = mmap(0, aligned_size, PROT_READ | PROT_WRITE, MAP_SHARED, devfd, offset * getpagesize());
+    mcontainer_record_call(start, MCONTAINER_REC_ALLOC, offset, size, 0, 0, data == MAP_FAILED ? -1 : 0);
+    return data;
 }
 
 /**
@@ -67,8 +100,12 @@ void *mcontainer_alloc(int devfd, __u64 offset, __u64 size)
 int mcontainer_lock(int devfd, __u64 offset)
 {
     struct memory_container_cmd cmd;
+    __u64 start = mcontainer_record_clock();
+    int ret;
     cmd.oid = offset;
-    return ioctl(devfd, MCONTAINER_IOCTL_LOCK, &cmd);
+    ret = ioctl(devfd, MCONTAINER_IOCTL_LOCK, &cmd);
+    mcontainer_record_call(start, MCONTAINER_REC_LOCK, offset, 0, 0, 0, ret);
+    return ret;
 }
 
 /**
@@ -77,8 +114,12 @@ int mcontainer_lock(int devfd, __u64 offset)
 int mcontainer_unlock(int devfd, __u64 offset)
 {
     struct memory_container_cmd cmd;
+    __u64 start = mcontainer_record_clock();
+    int ret;
     cmd.oid = offset;
-    return ioctl(devfd, MCONTAINER_IOCTL_UNLOCK, &cmd);
+    ret = ioctl(devfd, MCONTAINER_IOCTL_UNLOCK, &cmd);
+    mcontainer_record_call(start, MCONTAINER_REC_UNLOCK, offset, 0, 0, 0, ret);
+    return ret;
 }
 
 /**
@@ -87,6 +128,444 @@ int mcontainer_unlock(int devfd, __u64 offset)
 int mcontainer_free(int devfd, __u64 offset)
 {
     struct memory_container_cmd cmd;
+    __u64 start = mcontainer_record_clock();
+    int ret;
+    cmd.oid = offset;
+    ret = ioctl(devfd, MCONTAINER_IOCTL_FREE, &cmd);
+    mcontainer_record_call(start, MCONTAINER_REC_FREE, offset, 0, 0, 0, ret);
+    return ret;
+}
+
+/**
+ * Take a read-only, copy-on-write snapshot of the caller's container as
+ * container cid. Tasks join it with mcontainer_create() and map its objects
+ * with mcontainer_alloc_readonly(); it goes away when the last of them leaves,
+ * or when devfd is closed before anyone joined it.
+ */
+int mcontainer_snapshot(int devfd, int cid)
+{
+    struct memory_container_cmd cmd;
+    __u64 start = mcontainer_record_clock();
+    int ret;
+    cmd.cid = cid;
+    ret = ioctl(devfd, MCONTAINER_IOCTL_SNAPSHOT, &cmd);
+    mcontainer_record_call(start, MCONTAINER_REC_SNAPSHOT, 0, 0, cid, 0, ret);
+    return ret;
+}
+
+/**
+ * Map an existing object for reading only, as required for snapshots.
+ */
+void *mcontainer_alloc_readonly(int devfd, __u64 offset, __u64 size)
+{
+    __u64 aligned_size = ((size + getpagesize() - 1) / getpagesize()) * getpagesize();
+    __u64 start = mcontainer_record_clock();
+    void *data = mmap(0, aligned_size, PROT_READ, MAP_SHARED, devfd, offset * getpagesize());
+    mcontainer_record_call(start, MCONTAINER_REC_ALLOC_READONLY, offset, size, 0, 0, data == MAP_FAILED ? -1 : 0);
+    return data;
+}
+
+/**
+ * Write every object of the caller's container to fd at its current offset
+ * and advance the offset past the checkpoint.
+ */
+int mcontainer_checkpoint(int devfd, int fd)
+{
+    struct memory_container_checkpoint_cmd cmd;
+    __u64 start = mcontainer_record_clock();
+    int ret;
+    cmd.fd = fd;
+    cmd.offset = lseek(fd, 0, SEEK_CUR);
+    cmd.size = 0;
+    if ((ret = ioctl(devfd, MCONTAINER_IOCTL_CHECKPOINT, &cmd)) == 0)
+    {
+        lseek(fd, cmd.offset + cmd.size, SEEK_SET);
+    }
+    mcontainer_record_call(start, MCONTAINER_REC_CHECKPOINT, 0, cmd.size, 0, 0, ret);
+    return ret;
+}
+
+/**
+ * Rebuild the caller's container from a checkpoint read from fd at its
+ * current offset and advance the offset past the checkpoint.
+ */
+int mcontainer_restore(int devfd, int fd)
+{
+    struct memory_container_checkpoint_cmd cmd;
+    __u64 start = mcontainer_record_clock();
+    int ret;
+    cmd.fd = fd;
+    cmd.offset = lseek(fd, 0, SEEK_CUR);
+    cmd.size = 0;
+    if ((ret = ioctl(devfd, MCONTAINER_IOCTL_RESTORE, &cmd)) == 0)
+    {
+        lseek(fd, cmd.offset + cmd.size, SEEK_SET);
+    }
+    mcontainer_record_call(start, MCONTAINER_REC_RESTORE, 0, cmd.size, 0, 0, ret);
+    return ret;
+}
+
+/**
+ * Declare an object read-only so its pages are merged with identical pages
+ * of other containers. A later write to it gets a private copy of the page.
+ */
+int mcontainer_mark_readonly(int devfd, __u64 offset)
+{
+    struct memory_container_cmd cmd;
+    __u64 start = mcontainer_record_clock();
+    int ret;
+    cmd.oid = offset;
+    ret = ioctl(devfd, MCONTAINER_IOCTL_MARK_READONLY, &cmd);
+    mcontainer_record_call(start, MCONTAINER_REC_MARK_READONLY, offset, 0, 0, 0, ret);
+    return ret;
+}
+
+/**
+ * Fetch memory and compression statistics of the caller's container.
+ */
+int mcontainer_stats(int devfd, struct memory_container_stats *stats)
+{
+    __u64 start = mcontainer_record_clock();
+    int ret = ioctl(devfd, MCONTAINER_IOCTL_STATS, stats);
+    mcontainer_record_call(start, MCONTAINER_REC_STATS, 0, 0, 0, 0, ret);
+    return ret;
+}
+
+/**
+ * Tell the kernel how bytes [start, start + length) of an object will be
+ * used, one of the MCONTAINER_ADVICE_* values. length 0 means to the end.
+ * Bytes past the end of the object are ignored; a range that wraps around
+ * fails with EINVAL.
+ */
+int mcontainer_advise(int devfd, __u64 offset, __u64 start, __u64 length, int advice)
+{
+    struct memory_container_advise_cmd cmd;
+    __u64 time = mcontainer_record_clock();
+    int ret;
+    cmd.oid = offset;
+    cmd.offset = start;
+    cmd.length = length;
+    cmd.advice = advice;
+    ret = ioctl(devfd, MCONTAINER_IOCTL_ADVISE, &cmd);
+    mcontainer_record_call(time, MCONTAINER_REC_ADVISE, offset, length, start, advice, ret);
+    return ret;
+}
+
+/**
+ * Lock several objects at once. The kernel takes them in a fixed order and
+ * either gets all of them within timeout_ms (0 waits for ever) or none.
+ */
+int mcontainer_lock_set(int devfd, const __u64 *offsets, int count, int timeout_ms)
+{
+    struct memory_container_lockset_cmd cmd;
+    __u64 start = mcontainer_record_clock();
+    int ret;
+    cmd.oids = (__u64)(unsigned long)offsets;
+    cmd.count = count;
+    cmd.timeout_ms = timeout_ms;
+    ret = ioctl(devfd, MCONTAINER_IOCTL_LOCK_SET, &cmd);
+    mcontainer_record_list(start, MCONTAINER_REC_LOCK_SET, timeout_ms, ret, offsets, sizeof(__u64), count);
+    return ret;
+}
+
+/**
+ * Unlock a set of objects taken with mcontainer_lock_set()
+ */
+int mcontainer_unlock_set(int devfd, const __u64 *offsets, int count)
+{
+    struct memory_container_lockset_cmd cmd;
+    __u64 start = mcontainer_record_clock();
+    int ret;
+    cmd.oids = (__u64)(unsigned long)offsets;
+    cmd.count = count;
+    cmd.timeout_ms = 0;
+    ret = ioctl(devfd, MCONTAINER_IOCTL_UNLOCK_SET, &cmd);
+    mcontainer_record_list(start, MCONTAINER_REC_UNLOCK_SET, 0, ret, offsets, sizeof(__u64), count);
+    return ret;
+}
+
+/**
+ * Map the version header of an object for optimistic reads, see
+ * mcontainer_read_begin(). Returns NULL if the object does not exist.
+ */
+struct memory_container_object_header *mcontainer_map_header(int devfd, __u64 offset)
+{
+    __u64 start = mcontainer_record_clock();
+    void *header = mmap(0, getpagesize(), PROT_READ | PROT_WRITE, MAP_SHARED, devfd, (offset | MCONTAINER_HEADER_PAGE) * getpagesize());
+    // the address is what a later unmap is matched by
+    mcontainer_record_call(start, MCONTAINER_REC_MAP_HEADER, offset, 0, (__u64)(unsigned long)header, 0, header == MAP_FAILED ? -1 : 0);
+    if (header == MAP_FAILED)
+    {
+        return NULL;
+    }
+    return header;
+}
+
+/**
+ * Unmap a header returned by mcontainer_map_header()
+ */
+int mcontainer_unmap_header(struct memory_container_object_header *header)
+{
+    __u64 start = mcontainer_record_clock();
+    int ret = munmap(header, getpagesize());
+    mcontainer_record_call(start, MCONTAINER_REC_UNMAP_HEADER, 0, 0, (__u64)(unsigned long)header, 0, ret);
+    return ret;
+}
+
+/**
+ * Have the kernel compute the CRC32C of each object in digests[] (fill in
+ * oid, get back size, digest and a per-object status) without mapping them.
+ */
+int mcontainer_digest(int devfd, struct memory_container_digest *digests, int count)
+{
+    struct memory_container_digest_cmd cmd;
+    __u64 start = mcontainer_record_clock();
+    int ret;
+    cmd.digests = (__u64)(unsigned long)digests;
+    cmd.count = count;
+    ret = ioctl(devfd, MCONTAINER_IOCTL_DIGEST, &cmd);
+    mcontainer_record_list(start, MCONTAINER_REC_DIGEST, 0, ret, digests, sizeof(struct memory_container_digest), count);
+    return ret;
+}
+
+static long mcontainer_transfer(int devfd, unsigned long request, __u64 offset, __u64 start, int fd, __u64 length)
+{
+    struct memory_container_transfer_cmd cmd;
+    __u64 time = mcontainer_record_clock();
+    off_t position = lseek(fd, 0, SEEK_CUR);
+    int op = request == MCONTAINER_IOCTL_IMPORT ? MCONTAINER_REC_IMPORT : MCONTAINER_REC_EXPORT;
+    int ret;
     cmd.oid = offset;
-    return ioctl(devfd, MCONTAINER_IOCTL_FREE, &cmd);
-}
\ No newline at end of file
+    cmd.fd = fd;
+    // pipes and sockets have no offset
+    cmd.file_offset = position < 0 ? 0 : position;
+    cmd.object_offset = start;
+    cmd.length = length;
+    if ((ret = ioctl(devfd, request, &cmd)) != 0)
+    {
+        mcontainer_record_call(time, op, offset, length, start, 0, ret);
+        return ret;
+    }
+    if (position >= 0)
+    {
+        lseek(fd, position + cmd.length, SEEK_SET);
+    }
+    mcontainer_record_call(time, op, offset, length, start, 0, cmd.length);
+    return cmd.length;
+}
+
+/**
+ * Copy length bytes from fd at its current offset into an object starting
+ * at byte start, without a bounce buffer, and advance the offset. Returns
+ * the bytes copied, fewer only at end of file.
+ */
+long mcontainer_import(int devfd, __u64 offset, __u64 start, int fd, __u64 length)
+{
+    return mcontainer_transfer(devfd, MCONTAINER_IOCTL_IMPORT, offset, start, fd, length);
+}
+
+/**
+ * Copy length bytes of an object starting at byte start to fd (a file, pipe
+ * or socket) without a bounce buffer. Returns the bytes copied.
+ */
+long mcontainer_export(int devfd, __u64 offset, __u64 start, int fd, __u64 length)
+{
+    return mcontainer_transfer(devfd, MCONTAINER_IOCTL_EXPORT, offset, start, fd, length);
+}
+
+// Positioned I/O cannot reach past MCONTAINER_POS_OID_MAX or 4 GiB into an
+// object, fail instead of silently touching another object.
+static int mcontainer_pos_valid(__u64 offset, __u64 start)
+{
+    if (offset > MCONTAINER_POS_OID_MAX || start > MCONTAINER_POS_MASK)
+    {
+        errno = EINVAL;
+        return 0;
+    }
+    return 1;
+}
+
+/**
+ * Read count bytes of an object from byte start without mapping it.
+ * Returns fewer bytes at the end of the object.
+ */
+ssize_t mcontainer_pread(int devfd, __u64 offset, void *buf, size_t count, __u64 start)
+{
+    __u64 time = mcontainer_record_clock();
+    ssize_t ret = mcontainer_pos_valid(offset, start) ? pread(devfd, buf, count, MCONTAINER_POS(offset, start)) : -1;
+    mcontainer_record_call(time, MCONTAINER_REC_PREAD, offset, count, start, 0, ret);
+    return ret;
+}
+
+/**
+ * Write count bytes to an object at byte start without mapping it
+ */
+ssize_t mcontainer_pwrite(int devfd, __u64 offset, const void *buf, size_t count, __u64 start)
+{
+    __u64 time = mcontainer_record_clock();
+    ssize_t ret = mcontainer_pos_valid(offset, start) ? pwrite(devfd, buf, count, MCONTAINER_POS(offset, start)) : -1;
+    mcontainer_record_call(time, MCONTAINER_REC_PWRITE, offset, count, start, 0, ret);
+    return ret;
+}
+
+static __u64 mcontainer_iov_length(const struct iovec *iov, int iovcnt)
+{
+    __u64 length = 0;
+    int i;
+    for (i = 0; iov && i < iovcnt; i++)
+    {
+        length += iov[i].iov_len;
+    }
+    return length;
+}
+
+/**
+ * Scatter bytes of one object starting at byte start into several buffers
+ */
+ssize_t mcontainer_preadv(int devfd, __u64 offset, const struct iovec *iov, int iovcnt, __u64 start)
+{
+    __u64 time = mcontainer_record_clock();
+    ssize_t ret = mcontainer_pos_valid(offset, start) ? preadv(devfd, iov, iovcnt, MCONTAINER_POS(offset, start)) : -1;
+    mcontainer_record_call(time, MCONTAINER_REC_PREADV, offset, mcontainer_iov_length(iov, iovcnt), start, iovcnt, ret);
+    return ret;
+}
+
+/**
+ * Gather several buffers into one object starting at byte start
+ */
+ssize_t mcontainer_pwritev(int devfd, __u64 offset, const struct iovec *iov, int iovcnt, __u64 start)
+{
+    __u64 time = mcontainer_record_clock();
+    ssize_t ret = mcontainer_pos_valid(offset, start) ? pwritev(devfd, iov, iovcnt, MCONTAINER_POS(offset, start)) : -1;
+    mcontainer_record_call(time, MCONTAINER_REC_PWRITEV, offset, mcontainer_iov_length(iov, iovcnt), start, iovcnt, ret);
+    return ret;
+}
+
+/**
+ * Do a list of reads, each from its own object, in a single call. Every
+ * ios[i].result is set to the bytes read or a negative errno.
+ */
+int mcontainer_read_batch(int devfd, struct memory_container_io *ios, int count)
+{
+    struct memory_container_io_cmd cmd;
+    __u64 start = mcontainer_record_clock();
+    int ret;
+    cmd.ios = (__u64)(unsigned long)ios;
+    cmd.count = count;
+    ret = ioctl(devfd, MCONTAINER_IOCTL_READ_BATCH, &cmd);
+    mcontainer_record_list(start, MCONTAINER_REC_READ_BATCH, 0, ret, ios, sizeof(struct memory_container_io), count);
+    return ret;
+}
+
+/**
+ * Do a list of writes, each to its own object, in a single call. Every
+ * ios[i].result is set to the bytes written or a negative errno.
+ */
+int mcontainer_write_batch(int devfd, struct memory_container_io *ios, int count)
+{
+    struct memory_container_io_cmd cmd;
+    __u64 start = mcontainer_record_clock();
+    int ret;
+    cmd.ios = (__u64)(unsigned long)ios;
+    cmd.count = count;
+    ret = ioctl(devfd, MCONTAINER_IOCTL_WRITE_BATCH, &cmd);
+    mcontainer_record_list(start, MCONTAINER_REC_WRITE_BATCH, 0, ret, ios, sizeof(struct memory_container_io), count);
+    return ret;
+}
+
+/**
+ * Tell watchers of an object that it changed. Only needed after writing
+ * through a mapping without holding the object lock; unlocking an object
+ * that was written, and pwrite() and friends, publish by themselves.
+ */
+int mcontainer_publish(int devfd, __u64 offset)
+{
+    struct memory_container_cmd cmd;
+    __u64 start = mcontainer_record_clock();
+    int ret;
+    cmd.oid = offset;
+    ret = ioctl(devfd, MCONTAINER_IOCTL_PUBLISH, &cmd);
+    mcontainer_record_call(start, MCONTAINER_REC_PUBLISH, offset, 0, 0, 0, ret);
+    return ret;
+}
+
+/**
+ * Sleep until the object's generation differs from *generation, or for at
+ * most timeout_ms (0 waits for ever), and store the new one there. Start
+ * from the value mcontainer_watch() returned or from 0.
+ */
+int mcontainer_wait(int devfd, __u64 offset, __u64 *generation, int timeout_ms)
+{
+    struct memory_container_wait_cmd cmd;
+    __u64 start = mcontainer_record_clock(), from = *generation;
+    int ret;
+    cmd.oid = offset;
+    cmd.generation = *generation;
+    cmd.timeout_ms = timeout_ms;
+    if ((ret = ioctl(devfd, MCONTAINER_IOCTL_WAIT, &cmd)) == 0)
+    {
+        *generation = cmd.generation;
+    }
+    mcontainer_record_call(start, MCONTAINER_REC_WAIT, offset, 0, timeout_ms, from, ret);
+    return ret;
+}
+
+/**
+ * Make poll() on devfd readable when the object changes. Calling it again
+ * for a watched object acknowledges its changes so far; do that before
+ * reading the object so no update slips by. generation may be NULL.
+ */
+int mcontainer_watch(int devfd, __u64 offset, __u64 *generation)
+{
+    struct memory_container_watch_cmd cmd;
+    __u64 start = mcontainer_record_clock();
+    int ret;
+    cmd.oid = offset;
+    cmd.flags = MCONTAINER_WATCH_ADD;
+    if ((ret = ioctl(devfd, MCONTAINER_IOCTL_WATCH, &cmd)) == 0 && generation)
+    {
+        *generation = cmd.generation;
+    }
+    mcontainer_record_call(start, MCONTAINER_REC_WATCH, offset, 0, 0, 0, ret);
+    return ret;
+}
+
+/**
+ * Stop watching an object
+ */
+int mcontainer_unwatch(int devfd, __u64 offset)
+{
+    struct memory_container_watch_cmd cmd;
+    __u64 start = mcontainer_record_clock();
+    int ret;
+    cmd.oid = offset;
+    cmd.flags = MCONTAINER_WATCH_REMOVE;
+    ret = ioctl(devfd, MCONTAINER_IOCTL_WATCH, &cmd);
+    mcontainer_record_call(start, MCONTAINER_REC_UNWATCH, offset, 0, 0, 0, ret);
+    return ret;
+}
+
+/**
+ * Fetch how many bytes of the caller's container, and of each of its first
+ * count objects, were used in the last working-set window. totals may be
+ * NULL. Returns the number of objects in the container.
+ */
+int mcontainer_working_set(int devfd, struct memory_container_working_set *objects, int count, struct memory_container_working_set_cmd *totals)
+{
+    struct memory_container_working_set_cmd cmd;
+    __u64 start = mcontainer_record_clock();
+    int ret;
+    cmd.objects = (__u64)(unsigned long)objects;
+    cmd.count = count;
+    ret = ioctl(devfd, MCONTAINER_IOCTL_WORKING_SET, &cmd);
+    mcontainer_record_call(start, MCONTAINER_REC_WORKING_SET, 0, count, 0, 0, ret == 0 ? (long)cmd.count : ret);
+    if (ret != 0)
+    {
+        return ret;
+    }
+    if (totals)
+    {
+        *totals = cmd;
+    }
+    return cmd.count;
+}
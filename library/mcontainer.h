@@ -37,6 +37,7 @@ extern "C"
 #include <memory_container/memory_container.h>
 #include <sys/mman.h>
 #include <sys/ioctl.h>
+#include <sys/uio.h>
 #include <linux/types.h>
 #include <unistd.h>
 #include <stdio.h>
@@ -44,10 +45,167 @@ extern "C"
 
     int mcontainer_delete(int devfd);
     int mcontainer_create(int devfd, int cid);
+    int mcontainer_create_pooled(int devfd, int cid, __u64 pages);
     void *mcontainer_alloc(int devfd, __u64 offset, __u64 size);
     int mcontainer_lock(int devfd, __u64 offset);
     int mcontainer_unlock(int devfd, __u64 offset);
     int mcontainer_free(int devfd, __u64 offset);
+    int mcontainer_snapshot(int devfd, int cid);
+    void *mcontainer_alloc_readonly(int devfd, __u64 offset, __u64 size);
+    int mcontainer_checkpoint(int devfd, int fd);
+    int mcontainer_restore(int devfd, int fd);
+    int mcontainer_mark_readonly(int devfd, __u64 offset);
+    int mcontainer_stats(int devfd, struct memory_container_stats *stats);
+    int mcontainer_advise(int devfd, __u64 offset, __u64 start, __u64 length, int advice);
+    int mcontainer_lock_set(int devfd, const __u64 *offsets, int count, int timeout_ms);
+    int mcontainer_unlock_set(int devfd, const __u64 *offsets, int count);
+    struct memory_container_object_header *mcontainer_map_header(int devfd, __u64 offset);
+    int mcontainer_unmap_header(struct memory_container_object_header *header);
+    int mcontainer_digest(int devfd, struct memory_container_digest *digests, int count);
+    long mcontainer_import(int devfd, __u64 offset, __u64 start, int fd, __u64 length);
+    long mcontainer_export(int devfd, __u64 offset, __u64 start, int fd, __u64 length);
+    ssize_t mcontainer_pread(int devfd, __u64 offset, void *buf, size_t count, __u64 start);
+    ssize_t mcontainer_pwrite(int devfd, __u64 offset, const void *buf, size_t count, __u64 start);
+    ssize_t mcontainer_preadv(int devfd, __u64 offset, const struct iovec *iov, int iovcnt, __u64 start);
+    ssize_t mcontainer_pwritev(int devfd, __u64 offset, const struct iovec *iov, int iovcnt, __u64 start);
+    int mcontainer_read_batch(int devfd, struct memory_container_io *ios, int count);
+    int mcontainer_write_batch(int devfd, struct memory_container_io *ios, int count);
+    int mcontainer_publish(int devfd, __u64 offset);
+    int mcontainer_wait(int devfd, __u64 offset, __u64 *generation, int timeout_ms);
+    int mcontainer_watch(int devfd, __u64 offset, __u64 *generation);
+    int mcontainer_unwatch(int devfd, __u64 offset);
+    int mcontainer_working_set(int devfd, struct memory_container_working_set *objects, int count, struct memory_container_working_set_cmd *totals);
+
+    // Call recording, see mcontainer_record.c. A recording is one file per
+    // process: a header, then one record per library call in call order,
+    // each tagged with the thread that made it, as containers are joined
+    // per thread.
+    // time is in nanoseconds since the header's start (CLOCK_MONOTONIC), and
+    // processes forked from a recording process share their parent's start.
+    // Every call declared above is recorded; the ring and optimistic read
+    // helpers below show up as the alloc, lock, wait and publish calls they
+    // make.
+#define MCONTAINER_RECORD_MAGIC 0x44524f43454d434dULL
+#define MCONTAINER_RECORD_VERSION 3
+
+#define MCONTAINER_REC_CREATE 1
+#define MCONTAINER_REC_DELETE 2
+#define MCONTAINER_REC_ALLOC 3
+#define MCONTAINER_REC_ALLOC_READONLY 4
+#define MCONTAINER_REC_LOCK 5
+#define MCONTAINER_REC_UNLOCK 6
+#define MCONTAINER_REC_FREE 7
+#define MCONTAINER_REC_SNAPSHOT 8
+#define MCONTAINER_REC_MARK_READONLY 9
+#define MCONTAINER_REC_PREAD 10
+#define MCONTAINER_REC_PWRITE 11
+#define MCONTAINER_REC_PUBLISH 12
+#define MCONTAINER_REC_LOCK_SET 13
+#define MCONTAINER_REC_UNLOCK_SET 14
+#define MCONTAINER_REC_ADVISE 15
+#define MCONTAINER_REC_IMPORT 16
+#define MCONTAINER_REC_EXPORT 17
+#define MCONTAINER_REC_PREADV 18
+#define MCONTAINER_REC_PWRITEV 19
+#define MCONTAINER_REC_READ_BATCH 20
+#define MCONTAINER_REC_WRITE_BATCH 21
+#define MCONTAINER_REC_WAIT 22
+#define MCONTAINER_REC_WATCH 23
+#define MCONTAINER_REC_UNWATCH 24
+#define MCONTAINER_REC_CHECKPOINT 25
+#define MCONTAINER_REC_RESTORE 26
+#define MCONTAINER_REC_DIGEST 27
+#define MCONTAINER_REC_MAP_HEADER 28
+#define MCONTAINER_REC_UNMAP_HEADER 29
+#define MCONTAINER_REC_STATS 30
+#define MCONTAINER_REC_WORKING_SET 31
+#define MCONTAINER_REC_MEMBER 32
+
+    struct mcontainer_record_header
+    {
+        __u64 magic;
+        __u64 version;
+        __u64 start;
+        __u64 pid;
+    };
+
+    // size is the object or transfer size, or for calls on a list (lock and
+    // unlock sets, batches, digests, working sets) the number of MEMBER
+    // records that follow with one entry each: its oid, and for batches its
+    // length in size, offset in arg and own result. arg is the byte offset
+    // of a transfer, the pool size of a create, the cid of a snapshot, the
+    // timeout of a lock set or wait, or the address of a mapped header. arg2
+    // is the advice, the iovec count of a preadv/pwritev or the generation a
+    // wait started from. tid is the thread id of the caller and cid the
+    // container that thread was in. result is what the call returned, or
+    // -errno when it failed.
+    struct mcontainer_record
+    {
+        __u64 time;
+        __u64 oid;
+        __u64 size;
+        __u64 arg;
+        __u64 arg2;
+        __u32 cid;
+        __u32 op;
+        __u32 tid;
+        __u32 reserved;
+        __s64 result;
+    };
+
+    int mcontainer_record_start(const char *prefix);
+    void mcontainer_record_stop(void);
+
+    // Lock-free rings in container objects, see mcontainer_ring.c. A ring
+    // in object offset also takes object offset + 1 as the doorbell its
+    // waiters sleep on; do not use that oid for anything else.
+#define MCONTAINER_RING_SP_ENQ 1
+#define MCONTAINER_RING_SC_DEQ 2
+
+    struct mcontainer_ring;
+
+    struct mcontainer_ring *mcontainer_ring_create(int devfd, __u64 offset, unsigned int slot_size, unsigned int capacity, int flags);
+    struct mcontainer_ring *mcontainer_ring_attach(int devfd, __u64 offset);
+    void mcontainer_ring_detach(struct mcontainer_ring *ring);
+    unsigned int mcontainer_ring_enqueue_burst(struct mcontainer_ring *ring, const void *items, unsigned int n);
+    unsigned int mcontainer_ring_dequeue_burst(struct mcontainer_ring *ring, void *items, unsigned int n);
+    unsigned int mcontainer_ring_enqueue_wait(struct mcontainer_ring *ring, const void *items, unsigned int n, int timeout_ms);
+    unsigned int mcontainer_ring_dequeue_wait(struct mcontainer_ring *ring, void *items, unsigned int n, int timeout_ms);
+    unsigned int mcontainer_ring_count(struct mcontainer_ring *ring);
+
+    /**
+     * Optimistic readers: take a version with mcontainer_read_begin(), read
+     * the object, and start over while mcontainer_read_retry() says a writer
+     * got in between. Values read before the retry check may be torn and
+     * must not be acted upon until it passes.
+     */
+    static inline __u64 mcontainer_read_begin(const struct memory_container_object_header *header)
+    {
+        __u64 version;
+        while ((version = __atomic_load_n(&header->version, __ATOMIC_ACQUIRE)) & 1)
+            ;
+        return version;
+    }
+
+    static inline int mcontainer_read_retry(const struct memory_container_object_header *header, __u64 version)
+    {
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        return __atomic_load_n(&header->version, __ATOMIC_RELAXED) != version;
+    }
+
+    /**
+     * Writers must hold the object lock around write_begin ... write_end.
+     */
+    static inline void mcontainer_write_begin(struct memory_container_object_header *header)
+    {
+        __atomic_store_n(&header->version, header->version + 1, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_RELEASE);
+    }
+
+    static inline void mcontainer_write_end(struct memory_container_object_header *header)
+    {
+        __atomic_store_n(&header->version, header->version + 1, __ATOMIC_RELEASE);
+    }
 
 #ifdef __cplusplus
 }
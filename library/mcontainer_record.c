@@ -0,0 +1,318 @@
+//////////////////////////////////////////////////////////////////////
+//                      North Carolina State University
+//
+//
+//
+//                             Copyright 2016
+//
+////////////////////////////////////////////////////////////////////////
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms and conditions of the GNU General Public License,
+// version 2, as published by the Free Software Foundation.
+//
+// This program is distributed in the hope it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin St - Fifth Floor, Boston, MA 02110-1301 USA.
+//
+////////////////////////////////////////////////////////////////////////
+//
+//   Description:
+//     Recording of Library Calls for Offline Replay
+//
+////////////////////////////////////////////////////////////////////////
+
+#include "mcontainer.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sched.h>
+#include <string.h>
+#include <time.h>
+#include <sys/syscall.h>
+
+#define RECORD_BUFFER 1024
+
+// Records are collected in memory and written out when the buffer fills,
+// on mcontainer_record_stop() and at exit. A child of a recording process
+// notices the fork on its first call, drops what it inherited from the
+// parent's buffer and starts its own file with the parent's start time.
+// Processes that never call into the library leave no file behind. The lock
+// is held across fork() so the child never inherits it taken.
+static struct
+{
+    int enabled;
+    int lock;
+    int fd;
+    pid_t pid;
+    __u64 start;
+    unsigned int count;
+    char prefix[PATH_MAX - 32];
+    struct mcontainer_record records[RECORD_BUFFER];
+} recorder = { .fd = -1 };
+
+// The container each thread last created or joined, and its thread id
+static __thread __u32 record_cid;
+static __thread pid_t record_tid;
+
+static void record_lock(void)
+{
+    while (__atomic_exchange_n(&recorder.lock, 1, __ATOMIC_ACQUIRE))
+    {
+        sched_yield();
+    }
+}
+
+static void record_unlock(void)
+{
+    __atomic_store_n(&recorder.lock, 0, __ATOMIC_RELEASE);
+}
+
+static void record_child(void)
+{
+    // only the forking thread survives, and it held the lock
+    __atomic_store_n(&recorder.lock, 0, __ATOMIC_RELEASE);
+    record_tid = 0;
+}
+
+static __u64 record_now(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+static void record_flush(void)
+{
+    const char *data = (const char *)recorder.records;
+    size_t left = recorder.count * sizeof(struct mcontainer_record);
+    ssize_t written;
+    while (left > 0 && recorder.fd >= 0)
+    {
+        if ((written = write(recorder.fd, data, left)) < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            // keep the application going, just without a recording
+            close(recorder.fd);
+            recorder.fd = -1;
+            recorder.enabled = 0;
+            break;
+        }
+        data += written;
+        left -= written;
+    }
+    recorder.count = 0;
+}
+
+static int record_open(void)
+{
+    char filename[PATH_MAX];
+    struct mcontainer_record_header header;
+    recorder.pid = getpid();
+    recorder.count = 0;
+    snprintf(filename, sizeof(filename), "%s.%d.rec", recorder.prefix, (int)recorder.pid);
+    if ((recorder.fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)) < 0)
+    {
+        return -1;
+    }
+    header.magic = MCONTAINER_RECORD_MAGIC;
+    header.version = MCONTAINER_RECORD_VERSION;
+    header.start = recorder.start;
+    header.pid = recorder.pid;
+    if (write(recorder.fd, &header, sizeof(header)) != sizeof(header))
+    {
+        close(recorder.fd);
+        recorder.fd = -1;
+        return -1;
+    }
+    return 0;
+}
+
+static void record_exit(void)
+{
+    record_lock();
+    if (recorder.enabled && recorder.pid == getpid())
+    {
+        record_flush();
+    }
+    record_unlock();
+}
+
+/**
+ * Start recording the library calls of this process, and of the processes
+ * it forks, to <prefix>.<pid>.rec. Setting MCONTAINER_RECORD=<prefix> in the
+ * environment does the same before main() runs.
+ */
+int mcontainer_record_start(const char *prefix)
+{
+    static int registered;
+    int ret = 0;
+    record_lock();
+    if (!recorder.enabled)
+    {
+        snprintf(recorder.prefix, sizeof(recorder.prefix), "%s", prefix);
+        recorder.start = record_now();
+        // the file is created on the first call, by whichever process makes it
+        recorder.pid = 0;
+        recorder.enabled = 1;
+        if (!registered)
+        {
+            registered = 1;
+            ret = atexit(record_exit) || pthread_atfork(record_lock, record_unlock, record_child);
+        }
+    }
+    record_unlock();
+    return ret;
+}
+
+/**
+ * Write out what was recorded so far and stop recording
+ */
+void mcontainer_record_stop(void)
+{
+    record_lock();
+    if (recorder.enabled && recorder.pid == getpid())
+    {
+        record_flush();
+    }
+    if (recorder.fd >= 0)
+    {
+        close(recorder.fd);
+        recorder.fd = -1;
+    }
+    recorder.enabled = 0;
+    record_unlock();
+}
+
+__attribute__((constructor)) static void record_from_environment(void)
+{
+    const char *prefix = getenv("MCONTAINER_RECORD");
+    if (prefix && *prefix)
+    {
+        mcontainer_record_start(prefix);
+    }
+}
+
+// Called with the recorder locked: starts this process's own file if the
+// recorder was inherited across a fork. Returns whether to record.
+static int record_enter(void)
+{
+    if (recorder.pid != getpid())
+    {
+        if (recorder.fd >= 0)
+        {
+            close(recorder.fd);
+        }
+        if (record_open() != 0)
+        {
+            recorder.enabled = 0;
+        }
+    }
+    return recorder.enabled;
+}
+
+// Appends one record with the outcome of a call and returns it for the
+// caller to fill in the rest. Called with the recorder locked.
+static struct mcontainer_record *record_add(__u64 start, int op, long result, int saved)
+{
+    struct mcontainer_record *record;
+    if (recorder.count == RECORD_BUFFER)
+    {
+        record_flush();
+    }
+    record = &recorder.records[recorder.count++];
+    memset(record, 0, sizeof(*record));
+    if (record_tid == 0)
+    {
+        record_tid = syscall(SYS_gettid);
+    }
+    record->time = start > recorder.start ? start - recorder.start : 0;
+    record->tid = record_tid;
+    record->cid = record_cid;
+    record->op = op;
+    record->result = result < 0 ? -saved : result;
+    return record;
+}
+
+// Called by the wrappers in mcontainer.c: take the time before the call,
+// 0 when nothing is recorded, and pass it along with the outcome after it.
+// Creates pass the cid they join as oid.
+__u64 mcontainer_record_clock(void)
+{
+    return __atomic_load_n(&recorder.enabled, __ATOMIC_RELAXED) ? record_now() : 0;
+}
+
+void mcontainer_record_call(__u64 start, int op, __u64 oid, __u64 size, __u64 arg, __u64 arg2, long result)
+{
+    struct mcontainer_record *record;
+    int saved = errno;
+    if (start == 0)
+    {
+        return;
+    }
+    record_lock();
+    if (record_enter())
+    {
+        if (op == MCONTAINER_REC_CREATE && result == 0)
+        {
+            record_cid = oid;
+        }
+        record = record_add(start, op, result, saved);
+        record->oid = op == MCONTAINER_REC_CREATE ? 0 : oid;
+        record->size = size;
+        record->arg = arg;
+        record->arg2 = arg2;
+        if (op == MCONTAINER_REC_CREATE)
+        {
+            record->cid = (__u32)oid;
+        }
+    }
+    record_unlock();
+    errno = saved;
+}
+
+// Records a call on a list of count entries of stride bytes that each start
+// with their oid, followed by one MEMBER record per entry. Entries of the
+// batches are struct memory_container_io and keep their whole request.
+void mcontainer_record_list(__u64 start, int op, __u64 arg, long result, const void *items, size_t stride, int count)
+{
+    struct mcontainer_record *record;
+    int saved = errno, i;
+    if (start == 0)
+    {
+        return;
+    }
+    record_lock();
+    if (record_enter())
+    {
+        count = items ? count : 0;
+        record = record_add(start, op, result, saved);
+        record->size = count > 0 ? count : 0;
+        record->arg = arg;
+        for (i = 0; i < count; i++)
+        {
+            const void *item = (const char *)items + i * stride;
+            record = record_add(start, MCONTAINER_REC_MEMBER, 0, 0);
+            record->oid = *(const __u64 *)item;
+            if (op == MCONTAINER_REC_READ_BATCH || op == MCONTAINER_REC_WRITE_BATCH)
+            {
+                const struct memory_container_io *io = item;
+                record->size = io->length;
+                record->arg = io->offset;
+                record->result = io->result;
+            }
+        }
+    }
+    record_unlock();
+    errno = saved;
+}
@@ -0,0 +1,356 @@
+//////////////////////////////////////////////////////////////////////
+//                      North Carolina State University
+//
+//
+//
+//                             Copyright 2016
+//
+////////////////////////////////////////////////////////////////////////
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms and conditions of the GNU General Public License,
+// version 2, as published by the Free Software Foundation.
+//
+// This program is distributed in the hope it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin St - Fifth Floor, Boston, MA 02110-1301 USA.
+//
+////////////////////////////////////////////////////////////////////////
+//
+//   Description:
+//     Lock-free Ring Buffers in Container Objects
+//
+////////////////////////////////////////////////////////////////////////
+
+#include "mcontainer.h"
+
+#include <errno.h>
+#include <string.h>
+
+#define RING_MAGIC 0x474e49524e434dULL
+
+// Shared part of a ring, at the start of object offset. Producers reserve
+// slots by moving prod_head and make them visible by moving prod_tail in
+// the same order; consumers do the same with cons_head and cons_tail. The
+// indices only grow, a slot is index & (capacity - 1).
+struct mcontainer_ring_shared
+{
+    __u64 magic;
+    __u32 slot_size;
+    __u32 capacity;
+    __u32 flags;
+
+    __u64 prod_head __attribute__((aligned(64)));
+    __u64 prod_tail;
+
+    __u64 cons_head __attribute__((aligned(64)));
+    __u64 cons_tail;
+
+    __u32 prod_waiting __attribute__((aligned(64)));
+    __u32 cons_waiting;
+
+    unsigned char slots[] __attribute__((aligned(64)));
+};
+
+struct mcontainer_ring
+{
+    int devfd;
+    __u64 offset;
+    size_t size;
+    struct mcontainer_ring_shared *shared;
+};
+
+static inline void ring_pause(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#endif
+}
+
+static size_t ring_size(unsigned int slot_size, unsigned int capacity)
+{
+    return sizeof(struct mcontainer_ring_shared) + (size_t)slot_size * capacity;
+}
+
+static struct mcontainer_ring *ring_open(int devfd, __u64 offset, struct mcontainer_ring_shared *shared, size_t size)
+{
+    struct mcontainer_ring *ring = malloc(sizeof(struct mcontainer_ring));
+    if (!ring)
+    {
+        munmap(shared, size);
+        return NULL;
+    }
+    ring->devfd = devfd;
+    ring->offset = offset;
+    ring->size = size;
+    ring->shared = shared;
+    return ring;
+}
+
+static void ring_copy_in(struct mcontainer_ring_shared *s, __u64 index, const void *items, unsigned int n)
+{
+    unsigned int slot = index & (s->capacity - 1);
+    unsigned int first = n < s->capacity - slot ? n : s->capacity - slot;
+    memcpy(s->slots + (size_t)slot * s->slot_size, items, (size_t)first * s->slot_size);
+    memcpy(s->slots, (const char *)items + (size_t)first * s->slot_size, (size_t)(n - first) * s->slot_size);
+}
+
+static void ring_copy_out(struct mcontainer_ring_shared *s, __u64 index, void *items, unsigned int n)
+{
+    unsigned int slot = index & (s->capacity - 1);
+    unsigned int first = n < s->capacity - slot ? n : s->capacity - slot;
+    memcpy(items, s->slots + (size_t)slot * s->slot_size, (size_t)first * s->slot_size);
+    memcpy((char *)items + (size_t)first * s->slot_size, s->slots, (size_t)(n - first) * s->slot_size);
+}
+
+// Rings the doorbell object (offset + 1) if the other side sleeps on it.
+static void ring_notify(struct mcontainer_ring *ring, __u32 *waiting)
+{
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(waiting, __ATOMIC_RELAXED))
+    {
+        mcontainer_publish(ring->devfd, ring->offset + 1);
+    }
+}
+
+// Sleeps until the other side rings the doorbell, unless *index already
+// moved from seen. The waiting count goes up and the doorbell generation is
+// sampled before that last check, so a ring in between is never missed.
+static int ring_wait(struct mcontainer_ring *ring, __u32 *waiting, __u64 *index, __u64 seen, int timeout_ms)
+{
+    __u64 generation = ~0ULL;
+    int ret;
+    __atomic_fetch_add(waiting, 1, __ATOMIC_SEQ_CST);
+    ret = mcontainer_wait(ring->devfd, ring->offset + 1, &generation, 0);
+    if (ret == 0 && __atomic_load_n(index, __ATOMIC_SEQ_CST) == seen)
+    {
+        ret = mcontainer_wait(ring->devfd, ring->offset + 1, &generation, timeout_ms);
+    }
+    __atomic_fetch_sub(waiting, 1, __ATOMIC_SEQ_CST);
+    return ret;
+}
+
+/**
+ * Create a ring of capacity (a power of two) slots of slot_size bytes in
+ * object offset, or attach to it if another task created it already. The
+ * ring also uses object offset + 1 to sleep on, so leave that one alone.
+ * flags may hold MCONTAINER_RING_SP_ENQ and MCONTAINER_RING_SC_DEQ when
+ * there is only one producer or consumer.
+ */
+struct mcontainer_ring *mcontainer_ring_create(int devfd, __u64 offset, unsigned int slot_size, unsigned int capacity, int flags)
+{
+    struct mcontainer_ring_shared *shared;
+    size_t size;
+
+    if (capacity == 0 || (capacity & (capacity - 1)) || slot_size == 0)
+    {
+        errno = EINVAL;
+        return NULL;
+    }
+    slot_size = (slot_size + 7) & ~7U;
+    size = ring_size(slot_size, capacity);
+
+    if (mcontainer_lock(devfd, offset) != 0 && errno != EOWNERDEAD)
+    {
+        return NULL;
+    }
+    shared = mcontainer_alloc(devfd, offset, size);
+    if (shared == MAP_FAILED)
+    {
+        mcontainer_unlock(devfd, offset);
+        return NULL;
+    }
+    if (shared->magic == 0)
+    {
+        shared->slot_size = slot_size;
+        shared->capacity = capacity;
+        shared->flags = flags;
+        __atomic_store_n(&shared->magic, RING_MAGIC, __ATOMIC_RELEASE);
+    }
+    mcontainer_unlock(devfd, offset);
+    if (shared->magic != RING_MAGIC || shared->slot_size != slot_size || shared->capacity != capacity)
+    {
+        munmap(shared, size);
+        errno = EEXIST;
+        return NULL;
+    }
+
+    // locking creates the doorbell object
+    mcontainer_lock(devfd, offset + 1);
+    mcontainer_unlock(devfd, offset + 1);
+    return ring_open(devfd, offset, shared, size);
+}
+
+/**
+ * Attach to a ring another task created in object offset
+ */
+struct mcontainer_ring *mcontainer_ring_attach(int devfd, __u64 offset)
+{
+    struct mcontainer_ring_shared *shared;
+    size_t size;
+
+    shared = mcontainer_alloc(devfd, offset, sizeof(struct mcontainer_ring_shared));
+    if (shared == MAP_FAILED)
+    {
+        return NULL;
+    }
+    if (__atomic_load_n(&shared->magic, __ATOMIC_ACQUIRE) != RING_MAGIC)
+    {
+        munmap(shared, sizeof(struct mcontainer_ring_shared));
+        errno = ENOENT;
+        return NULL;
+    }
+    size = ring_size(shared->slot_size, shared->capacity);
+    munmap(shared, sizeof(struct mcontainer_ring_shared));
+    shared = mcontainer_alloc(devfd, offset, size);
+    if (shared == MAP_FAILED)
+    {
+        return NULL;
+    }
+    return ring_open(devfd, offset, shared, size);
+}
+
+/**
+ * Unmap a ring. Its contents stay in the object for other tasks.
+ */
+void mcontainer_ring_detach(struct mcontainer_ring *ring)
+{
+    munmap(ring->shared, ring->size);
+    free(ring);
+}
+
+/**
+ * Enqueue up to n slot-sized items without blocking and return how many
+ * went in.
+ */
+unsigned int mcontainer_ring_enqueue_burst(struct mcontainer_ring *ring, const void *items, unsigned int n)
+{
+    struct mcontainer_ring_shared *s = ring->shared;
+    __u64 head, next;
+    unsigned int count, space;
+
+    head = __atomic_load_n(&s->prod_head, __ATOMIC_RELAXED);
+    do
+    {
+        space = s->capacity - (unsigned int)(head - __atomic_load_n(&s->cons_tail, __ATOMIC_ACQUIRE));
+        count = n < space ? n : space;
+        if (count == 0)
+        {
+            return 0;
+        }
+        next = head + count;
+        if (s->flags & MCONTAINER_RING_SP_ENQ)
+        {
+            s->prod_head = next;
+            break;
+        }
+    } while (!__atomic_compare_exchange_n(&s->prod_head, &head, next, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+
+    ring_copy_in(s, head, items, count);
+
+    // earlier reservations have to become visible first
+    while (__atomic_load_n(&s->prod_tail, __ATOMIC_RELAXED) != head)
+    {
+        ring_pause();
+    }
+    __atomic_store_n(&s->prod_tail, next, __ATOMIC_RELEASE);
+    ring_notify(ring, &s->cons_waiting);
+    return count;
+}
+
+/**
+ * Dequeue up to n items into items without blocking and return how many
+ * came out.
+ */
+unsigned int mcontainer_ring_dequeue_burst(struct mcontainer_ring *ring, void *items, unsigned int n)
+{
+    struct mcontainer_ring_shared *s = ring->shared;
+    __u64 head, next;
+    unsigned int count, entries;
+
+    head = __atomic_load_n(&s->cons_head, __ATOMIC_RELAXED);
+    do
+    {
+        entries = (unsigned int)(__atomic_load_n(&s->prod_tail, __ATOMIC_ACQUIRE) - head);
+        count = n < entries ? n : entries;
+        if (count == 0)
+        {
+            return 0;
+        }
+        next = head + count;
+        if (s->flags & MCONTAINER_RING_SC_DEQ)
+        {
+            s->cons_head = next;
+            break;
+        }
+    } while (!__atomic_compare_exchange_n(&s->cons_head, &head, next, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+
+    ring_copy_out(s, head, items, count);
+
+    while (__atomic_load_n(&s->cons_tail, __ATOMIC_RELAXED) != head)
+    {
+        ring_pause();
+    }
+    __atomic_store_n(&s->cons_tail, next, __ATOMIC_RELEASE);
+    ring_notify(ring, &s->prod_waiting);
+    return count;
+}
+
+/**
+ * Enqueue all n items, sleeping in the kernel while the ring is full for
+ * at most timeout_ms at a time (0 waits for ever). Returns how many went
+ * in, fewer than n only on timeout or error.
+ */
+unsigned int mcontainer_ring_enqueue_wait(struct mcontainer_ring *ring, const void *items, unsigned int n, int timeout_ms)
+{
+    struct mcontainer_ring_shared *s = ring->shared;
+    unsigned int done = 0;
+    while (done < n)
+    {
+        __u64 seen = __atomic_load_n(&s->cons_tail, __ATOMIC_ACQUIRE);
+        unsigned int count = mcontainer_ring_enqueue_burst(ring, (const char *)items + (size_t)done * s->slot_size, n - done);
+        done += count;
+        if (count == 0 && ring_wait(ring, &s->prod_waiting, &s->cons_tail, seen, timeout_ms) != 0)
+        {
+            break;
+        }
+    }
+    return done;
+}
+
+/**
+ * Dequeue up to n items, sleeping in the kernel while the ring is empty
+ * for at most timeout_ms (0 waits for ever). Returns 0 only on timeout or
+ * error.
+ */
+unsigned int mcontainer_ring_dequeue_wait(struct mcontainer_ring *ring, void *items, unsigned int n, int timeout_ms)
+{
+    struct mcontainer_ring_shared *s = ring->shared;
+    unsigned int count;
+    for (;;)
+    {
+        __u64 seen = __atomic_load_n(&s->prod_tail, __ATOMIC_ACQUIRE);
+        if ((count = mcontainer_ring_dequeue_burst(ring, items, n)) != 0 || n == 0)
+        {
+            return count;
+        }
+        if (ring_wait(ring, &s->cons_waiting, &s->prod_tail, seen, timeout_ms) != 0)
+        {
+            return 0;
+        }
+    }
+}
+
+/**
+ * Number of items in the ring right now
+ */
+unsigned int mcontainer_ring_count(struct mcontainer_ring *ring)
+{
+    struct mcontainer_ring_shared *s = ring->shared;
+    return (unsigned int)(__atomic_load_n(&s->prod_tail, __ATOMIC_ACQUIRE) - __atomic_load_n(&s->cons_tail, __ATOMIC_ACQUIRE));
+}
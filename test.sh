@@ -13,12 +13,13 @@ number_of_containers=$4
 
 sudo insmod kernel_module/memory_container.ko
 sudo chmod 777 /dev/mcontainer
+# containers are freed when their last task leaves; stay in them until validated
+hold_pid=$(./benchmark/hold $4) || exit 1
 ./benchmark/benchmark $1 $2 $3 $4
-cat *.log > trace
-sort -n -k 4 trace > sorted_trace
-./benchmark/validate $1 $2 $4 < sorted_trace
+./benchmark/validate $1 $2 $4 mcontainer.*.trace
+kill $hold_pid
 
-# if you want to see the log for debugging, comment out the following line.
-rm -f *.log trace sorted_trace
+# if you want to see the traces for debugging, comment out the following line.
+rm -f mcontainer.*.trace
 
 sudo rmmod memory_container